@@ -35,9 +35,14 @@ If you have questions concerning this license or the applicable additional terms
 
 idCVar idMegaTexture::r_megaTextureLevel( "r_megaTextureLevel", "0", CVAR_RENDERER | CVAR_INTEGER, "draw only a specific level" );
 idCVar idMegaTexture::r_showMegaTexture( "r_showMegaTexture", "0", CVAR_RENDERER | CVAR_BOOL, "display all the level images" );
-idCVar idMegaTexture::r_showMegaTextureLabels( "r_showMegaTextureLabels", "0", CVAR_RENDERER | CVAR_BOOL, "draw colored blocks in each tile" );
+idCVar idMegaTexture::r_showMegaTextureLabels( "r_showMegaTextureLabels", "0", CVAR_RENDERER | CVAR_BOOL, "draw colored blocks in each streamed tile, the pinned levels only pick it up at load" );
 idCVar idMegaTexture::r_skipMegaTexture( "r_skipMegaTexture", "0", CVAR_RENDERER | CVAR_INTEGER, "only use the lowest level image" );
 idCVar idMegaTexture::r_terrainScale( "r_terrainScale", "3", CVAR_RENDERER | CVAR_INTEGER, "vertically scale USGS data" );
+idCVar idMegaTexture::r_megaTextureLevelSize( "r_megaTextureLevelSize", "1024", CVAR_RENDERER | CVAR_INTEGER, "width of the megatexture level images, the window of tiles each level keeps resident (clamped to the hardware max texture size)" );
+idCVar idMegaTexture::r_megaTextureUploadTiles( "r_megaTextureUploadTiles", "8", CVAR_RENDERER | CVAR_INTEGER, "max megatexture tiles uploaded per frame, 0 is unlimited" );
+idCVar idMegaTexture::r_megaTextureUploadTime( "r_megaTextureUploadTime", "1000", CVAR_RENDERER | CVAR_INTEGER, "microseconds per frame megatexture tile uploads can take, 0 is unlimited" );
+idCVar idMegaTexture::r_megaTextureHysteresis( "r_megaTextureHysteresis", "0.25", CVAR_RENDERER | CVAR_FLOAT, "fraction of a tile the view has to move past a tile edge before a level window follows it", 0.0f, 0.5f );
+idCVar idMegaTexture::r_megaTexturePrefetchTime( "r_megaTexturePrefetchTime", "500", CVAR_RENDERER | CVAR_INTEGER, "milliseconds ahead along the view velocity to prefetch megatexture tiles, 0 disables prefetching" );
 /*
 ====================
 idMegaTexture::idMegaTexture
@@ -95,6 +100,37 @@ bool idMegaTexture::InitFromMegaFile( const char *fileBase ) {
 	currentViewOrigin[1] = -99999999.0f;
 	currentViewOrigin[2] = -99999999.0f;
 
+	viewVelocity.Zero();
+	lastViewOriginTime = 0;
+
+	return true;
+}
+
+/*
+====================
+InitForBenchmark
+
+Just the tile streaming, no mask image and a made up surface, for megaBench.
+====================
+*/
+bool idMegaTexture::InitForBenchmark( const char *megaFileName, const idBounds &bounds ) {
+	megaNormalMaskImage = nullptr;
+
+	albedoLitMegaTextureFile = rvmMegaTextureFile::LoadMegaTextureFile( megaFileName );
+	if ( albedoLitMegaTextureFile == nullptr ) {
+		return false;
+	}
+
+	currentTriMapping = NULL;
+	surfaceBounds = bounds;
+
+	currentViewOrigin[0] = -99999999.0f;
+	currentViewOrigin[1] = -99999999.0f;
+	currentViewOrigin[2] = -99999999.0f;
+
+	viewVelocity.Zero();
+	lastViewOriginTime = 0;
+
 	return true;
 }
 
@@ -126,8 +162,11 @@ BindForViewOrigin
 ====================
 */
 void idMegaTexture::BindForViewOrigin( const idVec3 viewOrigin ) {
+	int		time = Sys_Milliseconds();
+
+	rvmMegaTextureBench::RecordViewOrigin( this, viewOrigin, time );
 
-	SetViewOrigin( viewOrigin );
+	SetViewOrigin( viewOrigin, time );
 
 	albedoLitMegaTextureFile->BindForViewOrigin(viewOrigin);
 
@@ -154,27 +193,12 @@ void idMegaTexture::Unbind( void ) {
 
 /*
 ====================
-SetViewOrigin
+ViewOriginToTexCenter
+
+TexCenter should be the normalized position between the min and max based on the player position.
 ====================
 */
-void idMegaTexture::SetViewOrigin( const idVec3 viewOrigin ) {
-	if ( r_showMegaTextureLabels.IsModified() ) {
-		r_showMegaTextureLabels.ClearModified();
-		currentViewOrigin[0] = viewOrigin[0] + 0.1;	// force a change
-		albedoLitMegaTextureFile->Invalidate();
-	}
-
-	if ( viewOrigin == currentViewOrigin ) {
-		return;
-	}
-	if ( r_skipMegaTexture.GetBool() ) {
-		return;
-	}
-
-	currentViewOrigin = viewOrigin;
-// jmarshall
-	float	texCenter[2];
-
+void idMegaTexture::ViewOriginToTexCenter( const idVec3 &viewOrigin, float texCenter[2] ) const {
 	// convert the viewOrigin to a texture center, which will
 	// be a different conversion for each megaTexture
 	//for ( int i = 0 ; i < 2 ; i++ ) {
@@ -185,9 +209,8 @@ void idMegaTexture::SetViewOrigin( const idVec3 viewOrigin ) {
 	//		localViewToTextureCenter[i][3];
 	//}
 
-	// TexCenter should be the normalized position between the min and max based on the player position.
 	idVec3 center = surfaceBounds.GetCenter();
-	idVec3 megaViewOrigin = currentViewOrigin - center;
+	idVec3 megaViewOrigin = viewOrigin - center;
 	idBounds megaBounds;
 	megaBounds[0] = surfaceBounds[0] - center;
 	megaBounds[1] = surfaceBounds[1] - center;
@@ -195,8 +218,85 @@ void idMegaTexture::SetViewOrigin( const idVec3 viewOrigin ) {
 	// Normalize megaViewOrigin between megabounds.
 	texCenter[0] = ((megaViewOrigin[0] - megaBounds[0][0]) / (megaBounds[1][0] - megaBounds[0][0]));
 	texCenter[1] = ((megaViewOrigin[1] - megaBounds[0][1]) / (megaBounds[1][1] - megaBounds[0][1]));
+}
+
+/*
+====================
+UpdateViewVelocity
+====================
+*/
+void idMegaTexture::UpdateViewVelocity( const idVec3 &viewOrigin, int time ) {
+	int deltaTime = time - lastViewOriginTime;
+
+	// first bind, or we haven't been drawn for a while (teleports, cinematics), start over.
+	if ( lastViewOriginTime == 0 || deltaTime <= 0 || deltaTime > 250 ) {
+		viewVelocity.Zero();
+	} else {
+		idVec3 frameVelocity = ( viewOrigin - currentViewOrigin ) * ( 1000.0f / deltaTime );
+
+		// smooth it out a bit so a single odd frame doesn't throw the prediction all over the place.
+		viewVelocity = viewVelocity * 0.5f + frameVelocity * 0.5f;
+	}
+
+	lastViewOriginTime = time;
+}
+
+/*
+====================
+PrefetchAlongPath
+
+Walks where the view will be over the next r_megaTexturePrefetchTime milliseconds,
+nearest first, and warms the tile cache with the tiles each level will need there.
+====================
+*/
+void idMegaTexture::PrefetchAlongPath( const idVec3 &viewOrigin ) {
+	static const int NUM_PREFETCH_STEPS = 4;
+
+	float prefetchTime = r_megaTexturePrefetchTime.GetInteger() * 0.001f;
+	if ( prefetchTime <= 0.0f || viewVelocity.LengthSqr() < 1.0f ) {
+		return;
+	}
+
+	for ( int i = 1 ; i <= NUM_PREFETCH_STEPS ; i++ ) {
+		float	texCenter[2];
+		idVec3	predictedOrigin = viewOrigin + viewVelocity * ( prefetchTime * i / NUM_PREFETCH_STEPS );
+
+		ViewOriginToTexCenter( predictedOrigin, texCenter );
+		albedoLitMegaTextureFile->PrefetchForCenter( texCenter );
+	}
+}
+
+/*
+====================
+SetViewOrigin
+====================
+*/
+void idMegaTexture::SetViewOrigin( const idVec3 viewOrigin, int time ) {
+	if ( r_showMegaTextureLabels.IsModified() ) {
+		r_showMegaTextureLabels.ClearModified();
+		currentViewOrigin[0] = viewOrigin[0] + 0.1;	// force a change
+		albedoLitMegaTextureFile->Invalidate();
+	}
+
+	if ( viewOrigin == currentViewOrigin ) {
+		return;
+	}
+	if ( r_skipMegaTexture.GetBool() ) {
+		return;
+	}
+
+	UpdateViewVelocity( viewOrigin, time );
+
+	currentViewOrigin = viewOrigin;
+// jmarshall
+	float	texCenter[2];
+
+	ViewOriginToTexCenter( currentViewOrigin, texCenter );
 
 	albedoLitMegaTextureFile->UpdateForCenter(texCenter);
+
+	// demand loads are queued first, the prefetches only get serviced once they are done.
+	PrefetchAlongPath( currentViewOrigin );
 // jmarshall end
 }
 
@@ -205,48 +305,166 @@ void idMegaTexture::SetViewOrigin( const idVec3 viewOrigin ) {
 ====================
 UpdateTile
 
-A local tile will only be mapped to globalTile[ localTile + X * TILE_PER_LEVEL ] for some x
+A local tile will only be mapped to globalTile[ localTile + X * tilesPerLevel ] for some x
 ====================
 */
 void idTextureLevel::UpdateTile( int localX, int localY, int globalX, int globalY ) {
 	idTextureTile	*tile = &tileMap[localX][localY];
 
-	if ( tile->x == globalX && tile->y == globalY ) {
+	if ( tile->requestedX == globalX && tile->requestedY == globalY ) {
 		return;
 	}
-	if ( (globalX & (TILE_PER_LEVEL-1)) != localX || (globalY & (TILE_PER_LEVEL-1)) != localY ) {
+	if ( (globalX & (tilesPerLevel-1)) != localX || (globalY & (tilesPerLevel-1)) != localY ) {
 		common->Error( "idTextureLevel::UpdateTile: bad coordinate mod" );
 	}
 
-	tile->x = globalX;
-	tile->y = globalY;
+	tile->requestedX = globalX;
+	tile->requestedY = globalY;
+
+	if ( tile->x == globalX && tile->y == globalY ) {
+		// the window moved back before the slot got overwritten, whatever was on its way is not wanted anymore
+		if ( mega->streamer->CancelTile( this, localX, localY ) ) {
+			stats.numCancels++;
+		}
+		return;
+	}
+
+	megaTileRequest_t request;
 
-	byte	data[ TILE_SIZE * TILE_SIZE ];
+	request.level = this;
+	request.localX = localX;
+	request.localY = localY;
+	request.globalX = globalX;
+	request.globalY = globalY;
+	request.tileNum = -1;
+	request.levelRank = mega->numLevels - 1 - (int)( this - mega->levels );
+	request.distance = idMath::Sqrt( Square( globalX + 0.5f - viewTile[0] ) + Square( globalY + 0.5f - viewTile[1] ) );
+	request.data = nullptr;
+	request.buffer = nullptr;
+	request.queueTime = Sys_Microseconds();
 
 	if ( globalX >= tilesWide || globalX < 0 || globalY >= tilesHigh || globalY < 0 ) {
-		// off the map
-		memset( data, 0, sizeof( data ) );
-	} else {
-		// extract the data from the full image (FIXME: background load from disk)
-		int		tileNum = tileOffset + tile->y * tilesWide + tile->x;
+		// off the map, nothing to load but the upload still counts against the frame budget
+		if ( mega->streamer->CancelTile( this, localX, localY ) ) {
+			stats.numCancels++;
+		}
+		stats.numOffMap++;
 
-		mega->ReadTile(data, tileNum);		
+		request.data = mega->offMapTile;
+		mega->QueueUpload( request );
+		return;
 	}
 
+	request.tileNum = mega->GetTileNum( *this, globalX, globalY );
+	stats.numRequests++;
+
+	mega->streamer->QueueTile( request );
+}
+
+/*
+====================
+UploadTile
+====================
+*/
+void idTextureLevel::UploadTile( int localX, int localY, int globalX, int globalY, const byte *data ) {
+	idTextureTile	*tile = &tileMap[localX][localY];
+	idTempArray<byte> labeled( idMegaTexture::r_showMegaTextureLabels.GetBool() ? tileSize * tileSize : 0 );
+
+	tile->x = globalX;
+	tile->y = globalY;
+
 	if ( idMegaTexture::r_showMegaTextureLabels.GetBool() ) {
+		// data can point into the read only file mapping, so mark up a copy
+		memcpy( labeled.Ptr(), data, tileSize * tileSize );
+		data = labeled.Ptr();
+
 		// put a color marker in it
-		byte	color[4] = { 255 * localX / TILE_PER_LEVEL, 255 * localY / TILE_PER_LEVEL, 0, 0 };
+		byte	color[4] = { 255 * localX / tilesPerLevel, 255 * localY / tilesPerLevel, 0, 0 };
 		for ( int x = 0 ; x < 8 ; x++ ) {
 			for ( int y = 0 ; y < 8 ; y++ ) {
-				*(int *)&data[ ( ( y + TILE_SIZE/2 - 4 ) * TILE_SIZE + x + TILE_SIZE/2 - 4 ) ] = *(int *)color;
+				*(int *)&labeled[ ( ( y + tileSize/2 - 4 ) * tileSize + x + tileSize/2 - 4 ) ] = *(int *)color;
 			}
 		}
 	}
 
-	// upload all the mip-map levels
-	int	level = 0;
-	int size = TILE_SIZE;
-	glCompressedTexSubImage2D(GL_TEXTURE_2D, level, localX * size, localY * size, size, size, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, size * size, data);
+	rvmMegaTextureFile::GetUploadBackend()->UploadTile( this, localX, localY, data );
+}
+
+static byte	levelFillColors[8][4] = {
+	{ 0, 0, 0, 255 },
+	{ 255, 0, 0, 255 },
+	{ 0, 255, 0, 255 },
+	{ 255, 255, 0, 255 },
+	{ 0, 0, 255, 255 },
+	{ 255, 0, 255, 255 },
+	{ 0, 255, 255, 255 },
+	{ 255, 255, 255, 255 }
+};
+
+/*
+====================
+R_EncodeFillBlock
+
+Builds a DXT5 block that decodes to a single color: both alpha endpoints and both
+color endpoints are the color and all the indices select endpoint 0.
+====================
+*/
+static void R_EncodeFillBlock( const byte color[4], byte block[16] ) {
+	unsigned short	rgb565 = ( ( color[0] >> 3 ) << 11 ) | ( ( color[1] >> 2 ) << 5 ) | ( color[2] >> 3 );
+
+	memset( block, 0, 16 );
+	block[0] = color[3];
+	block[1] = color[3];
+	block[8] = block[10] = rgb565 & 255;
+	block[9] = block[11] = rgb565 >> 8;
+}
+
+/*
+====================
+CreateImage
+
+Level images are created the first time a tile is uploaded to them, so a level that is never
+streamed in never costs a texture. The image is cleared to the level's debug color by uploading
+one tile worth of a pre-encoded block to every slot, instead of compressing a full RGBA level.
+====================
+*/
+void idTextureLevel::CreateImage() {
+	int		levelNum = this - mega->levels;
+	int		levelWidth = tilesPerLevel * tileSize;
+	char	str[1024];
+
+	sprintf( str, "_mega_%i", levelNum );
+
+	// the shader addresses every level as a repeating window of tilesPerLevel tiles,
+	// so the image has to cover the whole window even where the level is smaller
+	idImageOpts opts;
+	opts.format = FMT_DXT5;
+	opts.colorFormat = CFM_DEFAULT;
+	opts.gammaMips = 0;
+	opts.width = levelWidth;
+	opts.height = levelWidth;
+	opts.textureType = TT_2D;
+	opts.isPersistant = true;
+	opts.numMSAASamples = 0;
+	opts.numLevels = 1;
+
+	image = globalImages->ScratchImage( str, &opts, TF_LINEAR, TR_REPEAT, TD_DIFFUSE );
+
+	// give each level a default fill color
+	byte	block[16];
+	R_EncodeFillBlock( levelFillColors[( levelNum + 1 ) & 7], block );
+
+	idTempArray<byte> fill( tileSize * tileSize );
+	for ( int i = 0 ; i < tileSize * tileSize ; i += 16 ) {
+		memcpy( &fill[i], block, 16 );
+	}
+
+	image->Bind();
+	for ( int y = 0 ; y < tilesPerLevel ; y++ ) {
+		for ( int x = 0 ; x < tilesPerLevel ; x++ ) {
+			glCompressedTexSubImage2D( GL_TEXTURE_2D, 0, x * tileSize, y * tileSize, tileSize, tileSize, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, tileSize * tileSize, fill.Ptr() );
+		}
+	}
 }
 
 /*
@@ -257,46 +475,176 @@ Center is in the 0.0 to 1.0 range
 ====================
 */
 void idTextureLevel::UpdateForCenter( float center[2] ) {
+	float	global[2];
 	int		globalTileCorner[2];
-	int		localTileOffset[2];
-
-	if ( tilesWide <= TILE_PER_LEVEL && tilesHigh <= TILE_PER_LEVEL ) {
-		globalTileCorner[0] = 0;
-		globalTileCorner[1] = 0;
-		localTileOffset[0] = 0;
-		localTileOffset[1] = 0;
-		// orient the mask so that it doesn't mask anything at all
-		parms[0] = 0.25;
-		parms[1] = 0.25;
-		parms[3] = 0.25;
-	} else {
-		for ( int i = 0 ; i < 2 ; i++ ) {
-			float	global[2];
+	int		oldTileCorner[2];
+	float	hysteresis = idMath::ClampFloat( 0.0f, 0.5f, idMegaTexture::r_megaTextureHysteresis.GetFloat() );
 
-			// this value will be outside the 0.0 to 1.0 range unless
-			// we are in the corner of the megaTexture
-			global[i] = ( center[i] * parms[3] - 0.5 ) * TILE_PER_LEVEL;
+	if ( pinned ) {
+		return;
+	}
 
+	GetWindowPosition( center, global );
+
+	viewTile[0] = global[0] + tilesPerLevel * 0.5f;
+	viewTile[1] = global[1] + tilesPerLevel * 0.5f;
+
+	// only move the window once the center is past the rounding point by more than the
+	// hysteresis band, so a view sitting right on a tile edge doesn't keep flipping a row back and forth
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		oldTileCorner[i] = windowCorner[i];
+
+		if ( idMath::Fabs( global[i] - windowCorner[i] ) > 0.5f + hysteresis ) {
 			globalTileCorner[i] = (int)( global[i] + 0.5 );
+		} else {
+			globalTileCorner[i] = windowCorner[i];
+		}
+	}
+
+	if ( globalTileCorner[0] == oldTileCorner[0] && globalTileCorner[1] == oldTileCorner[1] ) {
+		return;
+	}
 
-			localTileOffset[i] = globalTileCorner[i] & (TILE_PER_LEVEL-1);
+	windowCorner[0] = globalTileCorner[0];
+	windowCorner[1] = globalTileCorner[1];
+
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		// scaling for the mask texture to only allow the proper window
+		// of tiles to show through
+		parms[i] = -globalTileCorner[i] / (float)tilesPerLevel;
+	}
 
-			// scaling for the mask texture to only allow the proper window
-			// of tiles to show through
-			parms[i] = -globalTileCorner[i] / (float)TILE_PER_LEVEL;
+	// columns that weren't in the old window, rows that stay in the window only need these
+	int		newColumnStart = globalTileCorner[0];
+	int		newColumnEnd = globalTileCorner[0] + tilesPerLevel;
+
+	if ( globalTileCorner[0] > oldTileCorner[0] ) {
+		newColumnStart = Max( globalTileCorner[0], oldTileCorner[0] + tilesPerLevel );
+	} else if ( globalTileCorner[0] < oldTileCorner[0] ) {
+		newColumnEnd = Min( globalTileCorner[0] + tilesPerLevel, oldTileCorner[0] );
+	} else {
+		newColumnEnd = newColumnStart;
+	}
+
+	uint64	startTime = Sys_Microseconds();
+
+	for ( int y = globalTileCorner[1] ; y < globalTileCorner[1] + tilesPerLevel ; y++ ) {
+		bool	newRow = ( y < oldTileCorner[1] || y >= oldTileCorner[1] + tilesPerLevel );
+		int		startX = newRow ? globalTileCorner[0] : newColumnStart;
+		int		endX = newRow ? globalTileCorner[0] + tilesPerLevel : newColumnEnd;
+
+		for ( int x = startX ; x < endX ; x++ ) {
+			UpdateTile( x & (tilesPerLevel-1), y & (tilesPerLevel-1), x, y );
 		}
 	}
 
-	image->Bind();
+	stats.updateMicroseconds += Sys_Microseconds() - startTime;
+
+	UpdateResidency();
+}
 
-	for ( int x = 0 ; x < TILE_PER_LEVEL ; x++ ) {
-		for ( int y = 0 ; y < TILE_PER_LEVEL ; y++ ) {
-			int		globalTile[2];
+/*
+====================
+SetUnmaskedParms
+
+For a level that fits entirely in the window, orient the mask so that it doesn't mask anything at all.
+The level is scaled to its own width within the window, like it is at load, and the mask coordinates
+are centered in the window so they stay clear of its clamped edges whatever the window size.
+====================
+*/
+void idTextureLevel::SetUnmaskedParms() {
+	float	scale = (float)tilesWide / (float)tilesPerLevel;
+
+	parms[0] = ( 1.0f - scale ) * 0.5f;
+	parms[1] = ( 1.0f - scale ) * 0.5f;
+	parms[3] = scale;
+}
+
+/*
+====================
+GetWindowPosition
+
+Global tile position the window for center would start at, before any rounding
+====================
+*/
+void idTextureLevel::GetWindowPosition( const float center[2], float global[2] ) const {
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		// this value will be outside the 0.0 to 1.0 range unless
+		// we are in the corner of the megaTexture
+		global[i] = ( center[i] * parms[3] - 0.5 ) * tilesPerLevel;
+	}
+}
+
+/*
+====================
+GetWindowCorner
+
+Global tile coordinates of the upper left tile in the window for center
+====================
+*/
+void idTextureLevel::GetWindowCorner( const float center[2], int globalTileCorner[2] ) const {
+	float	global[2];
+
+	GetWindowPosition( center, global );
+
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		globalTileCorner[i] = (int)( global[i] + 0.5 );
+	}
+}
+
+/*
+====================
+PrefetchForCenter
+
+Queues a cache prefetch for every tile in the window around center that isn't already in a slot
+====================
+*/
+void idTextureLevel::PrefetchForCenter( const float center[2] ) {
+	int		globalTileCorner[2];
+
+	if ( pinned ) {
+		return;
+	}
+
+	GetWindowCorner( center, globalTileCorner );
+
+	for ( int y = 0 ; y < tilesPerLevel ; y++ ) {
+		for ( int x = 0 ; x < tilesPerLevel ; x++ ) {
+			int		globalX = globalTileCorner[0] + x;
+			int		globalY = globalTileCorner[1] + y;
+
+			if ( globalX >= tilesWide || globalX < 0 || globalY >= tilesHigh || globalY < 0 ) {
+				continue;
+			}
 
-			globalTile[0] = globalTileCorner[0] + ( ( x - localTileOffset[0] ) & (TILE_PER_LEVEL-1) );
-			globalTile[1] = globalTileCorner[1] + ( ( y - localTileOffset[1] ) & (TILE_PER_LEVEL-1) );
+			const idTextureTile &tile = tileMap[globalX & (tilesPerLevel-1)][globalY & (tilesPerLevel-1)];
+			if ( tile.requestedX == globalX && tile.requestedY == globalY ) {
+				continue;
+			}
 
-			UpdateTile( x, y, globalTile[0], globalTile[1] );
+			mega->streamer->QueuePrefetch( mega->GetTileNum( *this, globalX, globalY ) );
+		}
+	}
+}
+
+/*
+=====================
+UpdateResidency
+
+The parms describe the requested window, they can only be used once every slot has caught up.
+=====================
+*/
+void idTextureLevel::UpdateResidency() {
+	resident = true;
+
+	for ( int x = 0 ; x < tilesPerLevel ; x++ ) {
+		for ( int y = 0 ; y < tilesPerLevel ; y++ ) {
+			const idTextureTile &tile = tileMap[x][y];
+
+			if ( tile.x != tile.requestedX || tile.y != tile.requestedY ) {
+				resident = false;
+				return;
+			}
 		}
 	}
 }
@@ -309,10 +657,15 @@ Forces all tiles to be regenerated
 =====================
 */
 void idTextureLevel::Invalidate() {
-	for ( int x = 0 ; x < TILE_PER_LEVEL ; x++ ) {
-		for ( int y = 0 ; y < TILE_PER_LEVEL ; y++ ) {
+	for ( int x = 0 ; x < tilesPerLevel ; x++ ) {
+		for ( int y = 0 ; y < tilesPerLevel ; y++ ) {
 			tileMap[x][y].x =
-			tileMap[x][y].y = -99999;
+			tileMap[x][y].y =
+			tileMap[x][y].requestedX =
+			tileMap[x][y].requestedY = -99999;
 		}
 	}
+	windowCorner[0] =
+	windowCorner[1] = -99999;
+	resident = false;
 }
@@ -32,40 +32,15 @@ struct rvmMegaTextureSourceFile_t
 {
 	rvmMegaTextureSourceFile_t()
 	{
-		scratch = nullptr;
-		scratch_position = 0;
 		file = nullptr;
 	}
 	~rvmMegaTextureSourceFile_t()
 	{
-		if (scratch)
-		{
-			delete scratch;
-			scratch = nullptr;
-		}
 		if (file)
 		{
 			fileSystem->CloseFile(file);
 			file = nullptr;
 		}
-
-		scratch_position = 0;
-	}
-
-	void AllocScratch(int len)
-	{
-		scratch = new byte[len];
-		scratch_position = 0;
-	}
-
-	void ResetScratch()
-	{
-		scratch_position = 0;
-	}
-
-	byte ReadByte()
-	{
-		return scratch[scratch_position++];
 	}
 
 	idFile *file;
@@ -73,26 +48,63 @@ struct rvmMegaTextureSourceFile_t
 	int     rows;
 	int     fileSize;
 	int numBytes;
-	byte *scratch;
-	int scratch_position;
 	
 	TargaHeader	targa_header;
 };
 
+// Converts a row of 8 bit gray, 24 bit BGR or 32 bit BGRA targa pixels to RGBA, writing each
+// pixel scale times across. The SSSE3 and AVX2 versions match the generic one bit for bit.
+typedef void (*megaTGARowDecoder_t)(const byte *in, byte *out, int columns, int scale);
+
+// The fastest row decoder this cpu can run, nullptr for a pixel size we can't read.
+megaTGARowDecoder_t R_GetTGARowDecoder(int pixelSize, int scale);
+
 class idTextureTile {
 public:
-	int		x, y;
+	int		x, y;					// tile currently uploaded to this slot
+	int		requestedX, requestedY;	// tile this slot is waiting on
 };
 
-static const int TILE_PER_LEVEL = 4;
 static const int MAX_MEGA_CHANNELS = 3;		// normal, diffuse, specular
 static const int MAX_LEVELS = 12;
-static const int MAX_LEVEL_WIDTH = 1024;
-static const int TILE_SIZE = MAX_LEVEL_WIDTH / TILE_PER_LEVEL;
+// jmarshall - the tile size comes from the .mega header and the window from r_megaTextureLevelSize.
+static const int MAX_TILE_PER_LEVEL = 16;
+static const int MIN_TILE_SIZE = 64;
+static const int MAX_TILE_SIZE = 1024;
+static const int DEFAULT_TILE_SIZE = 256;		// what makeMegaTexture builds without a tile size
+// jmarshall end
 
 class	idMegaTexture;
 class   rvmMegaTextureFile;
 
+// jmarshall
+// Request to upload latency, bucket i counts tiles that took less than 1 << i milliseconds and
+// the last bucket everything slower.
+static const int MEGA_LATENCY_BUCKETS = 12;
+
+struct megaLevelStats_t {
+	int				numRequests;					// tiles that had to be read
+	int				numOffMap;						// slots that only needed the off map tile
+	int				numCancels;						// reads dropped before they were serviced
+	int				numUploads;
+	int				numStale;						// read, but the window had moved on by the time it could go up
+	uint64			updateMicroseconds;				// in UpdateTile
+	uint64			totalLatencyMicroseconds;
+	uint64			maxLatencyMicroseconds;
+	int				latency[MEGA_LATENCY_BUCKETS];
+
+	void			AddLatency( uint64 microseconds );
+};
+
+struct megaFileStats_t {
+	int				numTileReads;					// tiles that came off disk or out of the mapping
+	int				numReadCalls;					// reads issued to the file, coalesced reads count once
+	int64			numBytesRead;
+	uint64			readMicroseconds;				// in ReadTile and ReadTiles
+	int				numUploadFrames;				// frames that had something to upload
+};
+// jmarshall end
+
 class idTextureLevel {
 public:
 	rvmMegaTextureFile	*mega;
@@ -100,25 +112,340 @@ public:
 	int				tileOffset;
 	int				tilesWide;
 	int				tilesHigh;
+	int				tileSize;						// from the file header
+	int				tilesPerLevel;					// tiles across the window, always a power of two
 
-	idImage			*image;
-	idTextureTile	tileMap[TILE_PER_LEVEL][TILE_PER_LEVEL];
+	idImage			*image;							// created on the first tile upload
+	idTextureTile	tileMap[MAX_TILE_PER_LEVEL][MAX_TILE_PER_LEVEL];	// only tilesPerLevel x tilesPerLevel are used
 
 	float			parms[4];
+	int				windowCorner[2];				// global tile at the upper left of the requested window
+	float			viewTile[2];					// global tile position of the view center
+	bool			resident;						// every slot holds the tile it was asked for
+	bool			pinned;							// the whole level fits in the window, loaded once with the file
+	megaLevelStats_t stats;
 
 	void			UpdateForCenter( float center[2] );
+	void			SetUnmaskedParms();
+	void			GetWindowPosition( const float center[2], float global[2] ) const;
+	void			GetWindowCorner( const float center[2], int globalTileCorner[2] ) const;
+	void			PrefetchForCenter( const float center[2] );
 	void			UpdateTile( int localX, int localY, int globalX, int globalY );
+	void			UploadTile( int localX, int localY, int globalX, int globalY, const byte *data );
+	void			CreateImage();
+	void			UpdateResidency();
 	void			Invalidate();
 };
 
+// jmarshall
+// Version 1 files only had tileSize, tilesWide and tilesHigh, the magic lets us tell them apart.
+// Version 2 added compression, version 3 the tile layout, version 4 the level descriptors and
+// 64 bit tile table offsets so a file can grow past 2 GB.
+static const int MEGA_FILE_MAGIC = ( 'M' | ( 'E' << 8 ) | ( 'G' << 16 ) | ( 'A' << 24 ) );
+static const int MEGA_FILE_VERSION = 4;
+
+// Levels a file can describe, enough for a 32k x 32k tile megatexture.
+static const int MAX_MEGA_FILE_LEVELS = 16;
+
+enum megaTileCompression_t {
+	MEGA_COMPRESSION_NONE,			// tiles are stored at tileNum * tileSize * tileSize
+	MEGA_COMPRESSION_ZLIB			// tiles are deflated, a megaTileTableEntry_t per tile follows the header
+};
+
+enum megaTileLayout_t {
+	MEGA_LAYOUT_LINEAR,				// y * tilesWide + x within each level
+	MEGA_LAYOUT_MORTON				// x and y bits interleaved within each level, so a window is a few runs of the file
+};
+// jmarshall end
+
+// jmarshall
+typedef struct {
+	int		tilesWide;
+	int		tilesHigh;
+	int		firstTile;				// tile number of the level's first tile
+	int		pad;
+	int64	offset;					// where the level starts in the file
+} megaLevelDesc_t;
+// jmarshall end
+
 typedef struct {
+	int		magic;
+	int		version;
 	int		tileSize;
 	int		tilesWide;
 	int		tilesHigh;
+	int		compression;
+	int		numTiles;				// every tile in the file, the header counts as tile 0
+	int		layout;					// megaTileLayout_t, version 3 and up
+	int		numLevels;				// version 4 and up, filled in from the tile counts for older files
+	int		pad;
+	megaLevelDesc_t	levels[MAX_MEGA_FILE_LEVELS];	// 0 is the base level, each one half the one before down to a single tile
 } megaTextureHeader_t;
 
 // jmarshall
+typedef struct {
+	int64	offset;
+	int		size;					// a tile that didn't get any smaller is stored as is
+	int		pad;
+} megaTileTableEntry_t;
+
+// What versions 2 and 3 stored, converted when the table is read.
+typedef struct {
+	int		offset;
+	int		size;
+} megaTileTableEntry32_t;
+// jmarshall end
+
+// jmarshall
+//
+// rvmMegaTextureReader
+//
+// Loose .mega files are memory mapped so tiles can be read from several threads without
+// copying, anything the filesystem can't hand us a real file for (pk4s) falls back to idFile.
+//
+class rvmMegaTextureReader {
+public:
+	rvmMegaTextureReader();
+	~rvmMegaTextureReader();
+
+	bool			Open(const char *name);
+	void			Close(void);
+
+	// Returns a pointer into the mapping or nullptr if the file isn't mapped.
+	const byte *	GetMappedData(int64 offset, int length) const;
+
+	// Faults the pages of a mapped range in on the calling thread.
+	void			TouchMappedData(const byte *data, int length) const;
+
+	// Positional read, safe to call from any thread.
+	bool			ReadAt(void *buffer, int64 offset, int length);
+
+	bool			IsMapped(void) const { return mappedData != nullptr; }
+	int64			Length(void) const { return length; }
+private:
+	idFile *		file;					// only kept open when we couldn't get an OS handle
+	idSysMutex		fileLock;
+	int64			length;
+	byte *			mappedData;
+#ifdef _WIN32
+	HANDLE			osHandle;
+	HANDLE			mappingHandle;
+#else
+	int				osHandle;
+#endif
+};
+
+//
+// rvmMegaTileCache
+//
+// LRU cache of DXT5 tiles that sits in front of ReadTile, so tiles that drop out of a level
+// window and come back a second later don't have to go back to disk. Tiles are keyed by
+// tileNum, which is unique for a level and tile x/y within a file.
+//
+class rvmMegaTileCache {
+public:
+	rvmMegaTileCache();
+	~rvmMegaTileCache();
+
+	void			Init(int tileBytes);
+	void			Clear(void);
+
+	// Copies the tile into tileBuffer and returns true if it is cached.
+	bool			Lookup(int tileNum, byte *tileBuffer);
+	bool			Contains(int tileNum);
+	void			Insert(int tileNum, const byte *tileData);
+
+	int				GetNumHits(void) const { return numHits; }
+	int				GetNumMisses(void) const { return numMisses; }
+	int				GetNumCachedTiles(void) const { return numUsedSlots; }
+	void			ClearStats(void) { numHits = 0; numMisses = 0; }
+	int				GetCacheSize(void) const { return numSlots * tileBytes; }
+private:
+	struct cacheSlot_t {
+		int							tileNum;
+		byte *						data;
+		idLinkList<cacheSlot_t>		lruNode;
+	};
+
+	void			Resize(int64 budgetBytes);
+	int				FindSlot(int tileNum) const;
+
+	idSysMutex		cacheLock;
+	int				tileBytes;
+	int64			budgetBytes;
+	int				numSlots;
+	int				numUsedSlots;
+	cacheSlot_t *	slots;
+	idHashIndex		slotHash;
+	idLinkList<cacheSlot_t>	lruList;				// most recently used at the front
+
+	int				numHits;
+	int				numMisses;
+};
+
+//
+// megaTileRequest_t
+//
+struct megaTileRequest_t {
+	idTextureLevel *	level;
+	int					localX;
+	int					localY;
+	int					globalX;
+	int					globalY;
+	int					tileNum;
+	int					levelRank;			// 0 is the coarsest level, which covers the most screen
+	float				distance;			// in tiles from the view center, within the level
+	const byte *		data;				// filled in by the streaming thread, may point straight into the file mapping
+	byte *				buffer;				// owned copy of the tile when the file could not be mapped
+	uint64				queueTime;			// Sys_Microseconds when UpdateTile asked for it
+};
+
+// Orders requests coarsest level first, then nearest the view first.
+int R_CompareTileRequests(const megaTileRequest_t *a, const megaTileRequest_t *b);
+
+//
+// rvmMegaTextureStreamer
+//
+// Reads tiles off disk on a worker thread, the render thread only queues requests
+// and uploads whatever has been completed.
+//
+class rvmMegaTextureStreamer : public idSysThread {
+public:
+	rvmMegaTextureStreamer(rvmMegaTextureFile *mega);
+	~rvmMegaTextureStreamer();
+
+	void			Start(void);
+	void			Shutdown(void);
+
+	// Queues a tile read, replacing any read still queued for the same level slot. Nothing gets
+	// read until ScheduleRequests is called, so a whole frame of requests is ranked together.
+	void			QueueTile(const megaTileRequest_t &request);
+
+	// Drops the read still queued for a level slot, returns false if there wasn't one.
+	bool			CancelTile(const idTextureLevel *level, int localX, int localY);
+
+	// Re-ranks everything queued against the current view and starts on it, without the
+	// streaming thread the reads are done right here.
+	void			ScheduleRequests(void);
+
+	// Queues a low priority read that only warms the tile cache, serviced once there are no tile requests left.
+	void			QueuePrefetch(int tileNum);
+
+	// Appends all the finished reads to completed, the caller owns the tile data.
+	void			GetCompletedTiles(idList<megaTileRequest_t> &completed);
+
+	// Nothing queued and nothing being read.
+	bool			IsIdle(void);
+
+	virtual int		Run(void);
+private:
+	// a window step is a row or column of tiles, read them together
+	static const int MAX_REQUEST_BATCH = MAX_TILE_PER_LEVEL;
+
+	void			ServiceRequests(megaTileRequest_t *requests, int numRequests);
+	void			ServicePrefetch(int tileNum);
+	int				GetNextRequests(megaTileRequest_t *requests, int maxRequests);
+
+	rvmMegaTextureFile *			mega;
+
+	idSysMutex						requestLock;
+	idList<megaTileRequest_t>		pendingRequests;	// kept sorted worst first so the best is popped off the end
+	bool							pendingSorted;
+	int								numInFlight;		// popped off pendingRequests, not completed yet
+	idList<megaTileRequest_t>		completedRequests;
+	idList<int>						prefetchRequests;
+	byte *							prefetchBuffer;
+};
+
+//
+// rvmMegaTileStagingPool
+//
+// Persistent tile sized buffers the streaming thread reads into and the render thread uploads
+// from, so streaming a tile doesn't go through the allocator twice.
+//
+class rvmMegaTileStagingPool {
+public:
+	rvmMegaTileStagingPool();
+	~rvmMegaTileStagingPool();
+
+	void			Init(int tileBytes, int numBuffers);
+	void			Shutdown(void);
+
+	// Never fails, once every buffer is in use it falls back to the heap.
+	byte *			Alloc(void);
+	void			Free(byte *buffer);
+
+	int				GetNumBuffers(void) const { return numBuffers; }
+	int				GetNumOverflows(void) const { return numOverflows; }
+private:
+	bool			IsPoolBuffer(const byte *buffer) const;
+
+	idSysMutex		poolLock;
+	int				tileBytes;
+	int				numBuffers;
+	byte *			memory;
+	idList<byte *>	freeBuffers;
+	int				numOverflows;					// allocations that had to go to the heap
+};
+
+//
+// rvmMegaTextureUploadBackend
+//
+// Everything that puts tiles into level images goes through here. Uploads are done in batches,
+// the level image is only bound again when the batch moves on to another level. The null
+// backend never touches the GPU so streaming can be measured headless.
+//
+class rvmMegaTextureUploadBackend {
+public:
+	rvmMegaTextureUploadBackend();
+	virtual ~rvmMegaTextureUploadBackend() {}
+
+	void			BeginBatch(void);
+	void			EndBatch(void);
+
+	// Uploads a DXT5 tile to the level image at tile slot x, y.
+	void			UploadTile(idTextureLevel *level, int x, int y, const byte *data);
+
+	void			ClearCounters(void);
+
+	int				numBatches;
+	int				numBinds;
+	int				numUploads;
+	int64			numUploadedBytes;
+protected:
+	virtual void	BindLevelImage(idTextureLevel *level) = 0;
+	virtual void	UploadTileImage(idTextureLevel *level, int x, int y, const byte *data) = 0;
+
+	idTextureLevel *boundLevel;
+};
+
+class rvmMegaTextureGLUploadBackend : public rvmMegaTextureUploadBackend {
+protected:
+	virtual void	BindLevelImage(idTextureLevel *level);
+	virtual void	UploadTileImage(idTextureLevel *level, int x, int y, const byte *data);
+};
+
+struct megaTileUploadRecord_t {
+	const idTextureLevel *	level;
+	int						x;
+	int						y;
+	int						bindNum;				// which bind this upload went out under
+};
+
+class rvmMegaTextureNullUploadBackend : public rvmMegaTextureUploadBackend {
+public:
+	rvmMegaTextureNullUploadBackend() { recordUploads = false; }
+
+	bool							recordUploads;
+	idList<megaTileUploadRecord_t>	uploads;
+protected:
+	virtual void	BindLevelImage(idTextureLevel *level) {}
+	virtual void	UploadTileImage(idTextureLevel *level, int x, int y, const byte *data);
+};
+
 class rvmMegaTextureFile {
+	friend class rvmMegaTextureStreamer;
+	friend class rvmMegaTextureBench;
 public:
 	~rvmMegaTextureFile();
 
@@ -126,21 +453,484 @@ public:
 	static rvmMegaTextureFile *LoadMegaTextureFile(const char *name);
 
 	void UpdateForCenter(float	texCenter[2]);
+	void PrefetchForCenter(const float texCenter[2]);
 	void BindForViewOrigin(const idVec3 viewOrigin); // binds images and sets program parameters
 	void Invalidate(void);
 
-	void ReadTile(byte *tileBuffer, int tileNum);
+	// Uploads the tiles the streaming thread has finished reading, as many as the frame budget allows.
+	void UploadCompletedTiles(void);
+
+	// Adds a tile that is ready to go to the pending uploads.
+	void QueueUpload(const megaTileRequest_t &request);
+
+	// Returns the tile data, either straight out of the file mapping or read into tileBuffer.
+	const byte *ReadTile(byte *tileBuffer, int tileNum);
+
+	// Reads a version 1 to 4 header, returns false if it doesn't look like a megatexture. Older
+	// headers get their level descriptors filled in.
+	static bool ParseHeader(const byte *data, int length, megaTextureHeader_t &header);
+
+	// Bytes the header takes up on disk, the tile table of a compressed file starts right after it.
+	static int HeaderLength(const megaTextureHeader_t &header);
+
+	// Fills in the level descriptors and tile count of a header from its base level, with the
+	// offsets of an uncompressed file.
+	static void InitLevels(megaTextureHeader_t &header);
+
+	// Bytes the tile table of a compressed file takes up on disk.
+	static int64 TileTableLength(const megaTextureHeader_t &header);
+
+	// Reads the tile table that follows the header, widening the 32 bit entries of older files.
+	// Fails on any tile bigger than a tile or that runs past the end of the file.
+	static bool ParseTileTable(const byte *data, const megaTextureHeader_t &header, int64 fileLength, idList<megaTileTableEntry_t> &tileTable);
+	static bool ReadTileTable(rvmMegaTextureReader &reader, const megaTextureHeader_t &header, idList<megaTileTableEntry_t> &tileTable);
+
+	// idFile seeks take a long, which is 32 bits on Windows, so get past 2 GB in steps.
+	static void SeekFile(idFile *file, int64 offset);
+
+	// Index of tile x, y within a level of the given size, levels start at their tileOffset.
+	static int TileIndex(int layout, int tilesWide, int tilesHigh, int x, int y);
+
+	// File tile number of tile x, y in level.
+	int GetTileNum(const idTextureLevel &level, int x, int y) const;
+
+	// Inflates a zlib compressed tile.
+	static bool DecompressTile(const byte *compressed, int compressedSize, byte *tileBuffer, int tileBytes);
+
+	// Reads a batch of tiles, neighbors in the file are merged into one read. Every tileBuffers
+	// entry needs to be tileBytes, tileData gets what ReadTile would have returned for each tile.
+	void ReadTiles(const int *tileNums, int numTiles, byte * const *tileBuffers, const byte **tileData);
+
+	// ReadTile with the tile cache in front of it, tileBuffer is always needed.
+	const byte *FetchTile(byte *tileBuffer, int tileNum);
+
+	// ReadTiles with the tile cache in front of it.
+	void FetchTiles(const int *tileNums, int numTiles, byte * const *tileBuffers, const byte **tileData);
+
+	// Where a tile is stored, false if there is no such tile.
+	bool GetTileExtent(int tileNum, int64 &offset, int &length) const;
+
+	// False for tiles that come straight out of the mapping, those skip the tile cache.
+	bool IsTileCacheable(int tileNum) const;
+
+	// Faults the pages of a mapped tile in without copying it anywhere.
+	void TouchTile(int tileNum);
+
+	// Reads every level that fits in the window in one go and uploads it, those levels never stream.
+	bool PreloadPinnedLevels(void);
+
+	// Streaming telemetry for the megaStats command.
+	void PrintStats(void);
+	void WriteStats(idFile *f, bool last);
+	void ClearStats(void);
+
+	// megaStats console command.
+	static void StatsCommand(const idCmdArgs &args);
+
+	const char *GetName(void) const { return name.c_str(); }
+
+	// Where all the megatexture uploads go, the GL backend unless a benchmark swapped it out.
+	static rvmMegaTextureUploadBackend *GetUploadBackend(void) { return uploadBackend; }
+	static void SetUploadBackend(rvmMegaTextureUploadBackend *backend);
 public:
 	int				numLevels;
 	idTextureLevel	levels[MAX_LEVELS];				// 0 is the highest resolution
 	megaTextureHeader_t	header;
+
+	int				tileSize;						// pixels across a tile
+	int				tileBytes;						// size of a DXT5 tile
+	int				tilesPerLevel;					// tiles across a level image
+	int				levelWidth;						// pixels across a level image
+	byte *			offMapTile;						// cleared tile for slots that hang off the map
+
+	rvmMegaTextureStreamer	*streamer;
 private:
 	rvmMegaTextureFile();
 
-	idFile			*fileHandle;
+	idStr					name;
+	rvmMegaTextureReader	reader;
+	idList<megaTileTableEntry_t> tileTable;		// only for compressed files
+	rvmMegaTileCache		tileCache;
+
+	idList<megaTileRequest_t>	pendingUploads;		// read, but waiting on the upload budget
+	rvmMegaTileStagingPool		stagingPool;		// request buffers
+
+	const byte *ReadTileData(byte *tileBuffer, int tileNum, int64 offset, int length);
+	void AddReadStats(int numTiles, int numReadCalls, int64 numBytes, uint64 microseconds);
+
+	idSysMutex					statsLock;			// reads are counted from the streaming thread
+	megaFileStats_t				stats;
+
+	static idList<rvmMegaTextureFile *> loadedFiles;
+	static rvmMegaTextureUploadBackend *uploadBackend;
 };
 // jmarshall end
 
+//
+// rvmMegaTextureBench
+//
+// Records the view origins megatextures get drawn from, and replays them against a megatexture
+// file with the null upload backend so streaming can be measured the same way every time, on a
+// box without a GPU if need be. Also times mip generation level by level.
+//
+class rvmMegaTextureBench {
+public:
+	static void		RecordViewOrigin(const idMegaTexture *megaTexture, const idVec3 &viewOrigin, int time);
+
+	static void		RecordPath_f(const idCmdArgs &args);
+	static void		Bench_f(const idCmdArgs &args);
+	static void		MakeSyntheticMegaTexture_f(const idCmdArgs &args);
+	static void		MipBench_f(const idCmdArgs &args);
+private:
+	struct pathFrame_t {
+		int			time;
+		idVec3		viewOrigin;
+	};
+
+	static bool		LoadPath(const char *fileName, const char *megaName, idStr &megaFileName, idBounds &bounds, idList<pathFrame_t> &frames);
+	static void		MakeSyntheticPath(int numFrames, idBounds &bounds, idList<pathFrame_t> &frames);
+	static void		Replay(const char *megaFileName, const idBounds &bounds, const idList<pathFrame_t> &frames, bool realTime);
+	static idFile *	CopyBaseLevel(rvmMegaTextureReader &in, const megaTextureHeader_t &header, const char *outName);
+	static uint64	HashMipLevels(const char *fileName, const megaTextureHeader_t &header);
+};
+
+//
+// megaBuildLevel_t
+//
+// Where a level being baked goes in the .mega, tile 0 being the header.
+//
+struct megaBuildLevel_t {
+	int				tileOffset;
+	int				tilesWide;
+	int				tilesHigh;
+};
+
+//
+// rvmMegaBakeReader
+//
+// Reads a file in fixed size blocks on its own thread, a few blocks ahead of the bake, so the
+// disk keeps going while the bake decodes what it already has.
+//
+class rvmMegaBakeReader : public idSysThread {
+public:
+	rvmMegaBakeReader();
+	~rvmMegaBakeReader();
+
+	// Reads numBlocks blocks of blockSize from where file is now, up to numBuffers ahead. A
+	// negative numBlocks reads until the first short read instead.
+	void			Start(idFile *file, int blockSize, int numBlocks, int numBuffers, const char *name);
+	void			Shutdown(void);
+
+	// Waits for the next block, it stays put until ReleaseBlock. length gets the bytes the file
+	// actually had for it. Returns nullptr once a read until the end has handed out every block.
+	const byte *	NextBlock(int *length = nullptr);
+	void			ReleaseBlock(void);
+
+	// How long NextBlock has waited on the disk.
+	uint64			GetWaitMicroseconds(void) const { return waitMicroseconds; }
+
+	virtual int		Run(void);
+private:
+	idFile *						file;
+	int								blockSize;
+	int								numBlocks;
+	idList<byte *>					buffers;			// block i goes in buffers[i % buffers.Num()]
+
+	idSysMutex						blockLock;
+	idSysSignal						blockRead;
+	int								numRead;
+	int								numReleased;
+	int								endBlock;			// the block the file ran out in, -1 until then
+	int								endLength;			// bytes of it that came from the file
+	uint64							waitMicroseconds;
+};
+
+//
+// rvmMegaTGABandReader
+//
+// Hands a source TGA to the bake a band of rows at a time, always uncompressed. Type 2 and 3
+// bands are read straight off the disk. Type 10 files are read in compressed blocks until the
+// file ends, and their packets are expanded into the band as it is asked for. A packet can run
+// over the end of a row, a band or a block, so what is left of it carries over to the next band.
+//
+class rvmMegaTGABandReader {
+public:
+	rvmMegaTGABandReader();
+	~rvmMegaTGABandReader();
+
+	// The file has to be just past the header and image id, like LoadTGA leaves it.
+	void			Start(idFile *file, const TargaHeader &targa_header, int bandRows, int numBands, int numBuffers, const char *name);
+	void			Shutdown(void);
+
+	// The next band of bandRows rows of columns pixels, as they'd be stored uncompressed.
+	const byte *	NextBand(void);
+	void			ReleaseBand(void);
+
+	bool			IsCompressed(void) const { return band != nullptr; }
+
+	// Bytes of the file read, and what they expanded to.
+	int64			GetSourceBytes(void) const { return sourceBytes; }
+	int64			GetBandBytes(void) const { return bandBytes; }
+
+	uint64			GetWaitMicroseconds(void) const { return reader.GetWaitMicroseconds(); }
+private:
+	void			DecodeBand(void);
+	void			ReadPacketBytes(byte *out, int length);
+
+	rvmMegaBakeReader				reader;
+	idStr							fileName;
+	int								bandSize;
+	int								pixelSize;			// bytes
+	int64							sourceBytes;
+	int64							bandBytes;
+
+	// only for run length encoded files
+	byte *							band;
+	const byte *					block;				// the reader block being expanded, if any
+	int								blockLength;
+	int								blockPos;
+	int								packetPixels;		// left of the current packet
+	bool							packetIsRun;
+	byte							runPixel[4];
+};
+
+//
+// rvmMegaBakeSource
+//
+// Where the bake gets its albedo from, a row of tiles at a time. Usually a giant TGA, but megagen
+// can hand its scanlines over as it builds them instead of going through the disk.
+//
+class rvmMegaBakeSource {
+public:
+	virtual			~rvmMegaBakeSource() {}
+
+	virtual int		GetWidth(void) const = 0;
+	virtual int		GetHeight(void) const = 0;
+
+	// Called once the bake knows it will read numBands bands of bandRows rows.
+	virtual void	Start(int bandRows, int numBands) = 0;
+	virtual void	Shutdown(void) {}
+
+	// Fills in the next band, bandRows rows of GetWidth RGBA pixels.
+	virtual void	ReadBand(byte *rgba) = 0;
+
+	// For the bake summary, how long the source kept the bake waiting and how much it read.
+	virtual uint64	GetWaitMicroseconds(void) const { return 0; }
+	virtual int64	GetSourceBytes(void) const { return 0; }
+	virtual int64	GetBandBytes(void) const { return 0; }
+};
+
+//
+// rvmMegaTGABakeSource
+//
+// The albedo TGA that megagen left in megagen/bin.
+//
+class rvmMegaTGABakeSource : public rvmMegaBakeSource {
+public:
+	bool			Open(const char *name);
+
+	virtual int		GetWidth(void) const { return source.targa_header.width; }
+	virtual int		GetHeight(void) const { return source.targa_header.height; }
+
+	virtual void	Start(int bandRows, int numBands);
+	virtual void	Shutdown(void);
+	virtual void	ReadBand(byte *rgba);
+
+	virtual uint64	GetWaitMicroseconds(void) const { return reader.GetWaitMicroseconds(); }
+	virtual int64	GetSourceBytes(void) const { return reader.GetSourceBytes(); }
+	virtual int64	GetBandBytes(void) const { return reader.GetBandBytes(); }
+private:
+	rvmMegaTextureSourceFile_t		source;
+	rvmMegaTGABandReader			reader;
+	int								bandRows;
+};
+
+//
+// rvmMegaBakeWriter
+//
+// Writes finished tiles behind the bake on its own thread. A write is a buffer and the spans
+// of it that go to the file, spans that follow on from each other in both are merged so a row
+// that is contiguous in the file goes out in one write.
+//
+class rvmMegaBakeWriter : public idSysThread {
+public:
+	rvmMegaBakeWriter();
+	~rvmMegaBakeWriter();
+
+	void			Start(idFile *file, int bufferSize, int numBuffers, const char *name);
+
+	// Writes everything still queued first.
+	void			Shutdown(void);
+
+	// Waits for a free buffer to fill.
+	byte *			BeginWrite(void);
+	void			AddSpan(int64 fileOffset, int bufferOffset, int length);
+	void			EndWrite(void);
+
+	// Waits for everything queued to be written.
+	void			Flush(void);
+
+	// How long BeginWrite and Flush have waited on the disk.
+	uint64			GetWaitMicroseconds(void) const { return waitMicroseconds; }
+
+	virtual int		Run(void);
+private:
+	struct span_t {
+		int64						fileOffset;
+		int							bufferOffset;
+		int							length;
+	};
+
+	struct write_t {
+		byte *						buffer;
+		idList<span_t>				spans;
+	};
+
+	idFile *						file;
+	idList<byte *>					buffers;
+	idList<byte *>					freeBuffers;
+	write_t							current;
+	idList<write_t>					queuedWrites;
+
+	idSysMutex						writeLock;
+	idSysSignal						writeDone;
+	int								numPending;
+	uint64							waitMicroseconds;
+};
+
+//
+// rvmMegaTileEncoder
+//
+// Spreads the YCoCg DXT5 encoding of a row of tiles over worker threads, while the build reads
+// and composes the next row. Mip rows can also be filtered from their already encoded
+// children, or a run of finished tiles deflated for the compressed file. The row is written in
+// tile order once it is done, so the file comes out byte for byte the same as a single threaded
+// build.
+//
+class rvmMegaTileEncoder;
+
+class rvmMegaTileEncodeWorker : public idSysThread {
+public:
+	rvmMegaTileEncodeWorker(rvmMegaTileEncoder *encoder, int tileSize);
+	~rvmMegaTileEncodeWorker();
+
+	virtual int		Run(void);
+private:
+	rvmMegaTileEncoder *	encoder;
+	byte *					scratch;			// two RGBA tiles
+};
+
+class rvmMegaTileEncoder {
+public:
+	rvmMegaTileEncoder();
+	~rvmMegaTileEncoder();
+
+	// numThreads 0 uses every core, rows are encoded straight into the writer's buffers.
+	void			Init(const megaTextureHeader_t &header, int numThreads, rvmMegaBakeWriter *writer);
+	void			Shutdown(void);
+
+	// Starts on a row of tiles out of tileSize rows of RGBA texels rowWidth texels apart, they
+	// have to be left alone until WriteRow returns.
+	void			EncodeRow(const megaBuildLevel_t &level, const byte *rows, int rowWidth, int tileRow);
+
+	// Starts on a row of base level tiles composed straight out of albedo and lightmap rows, both
+	// rowWidth texels apart. Each tile also box filters itself into its quarter of mipRows, the
+	// row of the first mip level mipWidth texels wide, unless that is null.
+	void			EncodeBaseRow(const megaBuildLevel_t &level, const byte *albedo, const byte *lit, int rowWidth, int ambient, byte *mipRows, int mipWidth, int tileRow);
+
+	// Starts on a row of tiles box filtered from their DXT5 children, childTiles holds childRows
+	// rows of childTilesWide tiles of the level below.
+	void			EncodeMipRow(const megaBuildLevel_t &level, const byte *childTiles, int childTilesWide, int childRows, int tileRow);
+
+	// Starts deflating numTiles DXT5 tiles, which go out back to back from fileOffset. WriteRow
+	// fills in their entries, a tile that doesn't shrink is stored as is. The writer's buffers
+	// have to hold numTiles times GetDeflateBound.
+	void			DeflateRow(const byte *tiles, int numTiles, megaTileTableEntry_t *entries, int64 fileOffset);
+	static int		GetDeflateBound(int tileSize);
+
+	// Helps finish the row started and queues its tiles, does nothing without one.
+	void			WriteRow(void);
+
+	int				GetNumThreads(void) const { return workers.Num() + 1; }
+private:
+	friend class rvmMegaTileEncodeWorker;
+
+	void			StartRow(void);
+
+	// Returns false once every tile of the row has been handed out.
+	bool			EncodeNextTile(byte *scratch);
+	void			FilterChildTiles(int rowBlock, byte *tileRGBA, byte *childRGBA) const;
+	void			DeflateTile(int rowBlock);
+
+	megaTextureHeader_t					header;
+	idList<rvmMegaTileEncodeWorker *>	workers;
+	rvmMegaBakeWriter *					writer;
+
+	idSysMutex							tileLock;
+	megaBuildLevel_t					level;
+	const byte *						rows;
+	int									rowWidth;
+	const byte *						lit;				// with rows, for a base row
+	int									ambient;
+	byte *								mipRows;
+	int									mipWidth;
+	const byte *						childTiles;
+	int									childTilesWide;
+	int									childRows;
+	const byte *						rawTiles;			// DXT5 tiles for a deflated row
+	megaTileTableEntry_t *				deflatedEntries;
+	int64								deflatedOffset;
+	int									deflateBound;
+	int									tileRow;			// -1 when no row is being encoded
+	int									rowTiles;
+	int									nextTile;
+	byte *								encodedRow;			// DXT5 tiles of the row in rowBlock order, from the writer
+	byte *								scratch;			// for the build thread
+};
+
+//
+// rvmMegaMipBuilder
+//
+// Builds the mip levels while the base level is baked, straight from the composed texels instead
+// of reading DXT tiles back. Each level only holds a row of tiles, the top half filled from one
+// row of the level below it and the bottom half from the next, and it is encoded as soon as it
+// is full. The encoder fills the first level as it composes the base tiles, every level is
+// encoded once, from full precision texels.
+//
+class rvmMegaMipBuilder {
+public:
+	rvmMegaMipBuilder();
+	~rvmMegaMipBuilder();
+
+	void			Init(const megaTextureHeader_t &header, rvmMegaTileEncoder *encoder);
+	void			Shutdown(void);
+
+	// Where the encoder filters the next row of base tiles to, null without mip levels.
+	byte *			BeginBaseRow(int &mipWidth);
+
+	// Once the encoder is done with that row.
+	void			EndBaseRow(void);
+
+	// Encodes the rows left half full when a level has an odd number of tiles high.
+	void			Finish(void);
+private:
+	struct mipLevel_t {
+		megaBuildLevel_t	level;
+		int					width;				// texels
+		byte *				rows[2];			// one is filled while the encoder has the other
+		int					current;
+		int					tileRow;
+		int					halvesFilled;
+	};
+
+	void			Downsample(int levelNum, const byte *rows, int rowWidth);
+	void			EmitRow(int levelNum);
+
+	int								tileSize;
+	rvmMegaTileEncoder *			encoder;
+	idList<mipLevel_t>				levels;
+};
+
 class idMegaTexture {
 public:
 	idMegaTexture();
@@ -152,22 +942,36 @@ public:
 	void	Unbind();								// removes texture bindings
 
 	static	void MakeMegaTexture_f( const idCmdArgs &args );
+
+	// Bakes megaTextures/<baseName>.mega from albedo and megaTextures/<baseName>_lit.tga.
+	static	bool BakeMegaTexture( const char *baseName, rvmMegaBakeSource *albedo, int tileSize );
 private:
 	friend class idTextureLevel;
 // jmarshall
 	friend class rvmMegaTextureFile;
+	friend class rvmMegaTextureStreamer;
+	friend class rvmMegaTileCache;
 // jmarshall end
-	void	SetViewOrigin( const idVec3 origin );
-	static void	GenerateMegaMipMaps( megaTextureHeader_t *header, idFile *file );
+	friend class rvmMegaTextureBench;
+	friend class rvmMegaTGABakeSource;
+	void	SetViewOrigin( const idVec3 origin, int time );
+	void	ViewOriginToTexCenter( const idVec3 &viewOrigin, float texCenter[2] ) const;
+	void	UpdateViewVelocity( const idVec3 &viewOrigin, int time );
+	bool	InitForBenchmark( const char *megaFileName, const idBounds &bounds );
+	void	PrefetchAlongPath( const idVec3 &viewOrigin );
+	static void	GenerateMegaMipMaps( const megaTextureHeader_t *header, idFile *file, int numThreads, idList<uint64> *levelMicroseconds = nullptr );
 	static void	GenerateMegaPreview( const char *fileName );
+	static bool	CompressMegaTexture( const char *rawName, const char *outName, int numThreads );
 // jmarshall
-	static void ProcessTGABlock(rvmMegaTextureSourceFile_t *file, byte *targa_rgba, TargaHeader	&targa_header, int columns, int rows, int scale);
+	static void ProcessTGABlock(const byte *data, byte *targa_rgba, TargaHeader	&targa_header, int columns, int rows, int scale, int tileSize);
 	static idFile *LoadTGA(const char *name, TargaHeader &targa_header, int	&columns, int &rows, int &fileSize, int &numBytes);
 // jmarshall end
 
 	const srfTriangles_t *currentTriMapping;
 
 	idVec3			currentViewOrigin;
+	idVec3			viewVelocity;					// units per second, smoothed over a few frames
+	int				lastViewOriginTime;
 // jmarshall
 //	float			localViewToTextureCenter[2][4];
 	idBounds		surfaceBounds;
@@ -187,9 +991,20 @@ private:
 	static idCVar	r_showMegaTextureLabels;
 	static idCVar	r_skipMegaTexture;
 	static idCVar	r_terrainScale;
+	static idCVar	r_megaTextureLevelSize;
+	static idCVar	r_megaTextureUploadTiles;
+	static idCVar	r_megaTextureUploadTime;
+	static idCVar	r_megaTextureHysteresis;
+	static idCVar	r_megaTexturePrefetchTime;
 
 // jmarshall
 	static idCVar	r_megatexture_ambient;
+	static idCVar	r_megatexture_compress;
+	static idCVar	r_megatexture_morton;
+	static idCVar	r_megaTextureStreamThread;
+	static idCVar	r_megaTextureCacheSize;
+	static idCVar	r_megaTextureStagingBuffers;
+	static idCVar	r_megaTextureBuildThreads;
 // jmarshall end
 };
 
@@ -0,0 +1,374 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+/*
+===========================
+rvmMegaBakeReader::rvmMegaBakeReader
+===========================
+*/
+rvmMegaBakeReader::rvmMegaBakeReader() {
+	file = nullptr;
+	blockSize = 0;
+	numBlocks = 0;
+	numRead = 0;
+	numReleased = 0;
+	endBlock = -1;
+	endLength = 0;
+	waitMicroseconds = 0;
+}
+
+/*
+===========================
+rvmMegaBakeReader::~rvmMegaBakeReader
+===========================
+*/
+rvmMegaBakeReader::~rvmMegaBakeReader() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaBakeReader::Start
+===========================
+*/
+void rvmMegaBakeReader::Start(idFile *file, int blockSize, int numBlocks, int numBuffers, const char *name) {
+	Shutdown();
+
+	this->file = file;
+	this->blockSize = blockSize;
+	this->numBlocks = numBlocks;
+	numRead = 0;
+	numReleased = 0;
+	endBlock = -1;
+	endLength = 0;
+	waitMicroseconds = 0;
+
+	for (int i = 0; i < numBuffers; i++) {
+		buffers.Append((byte *)R_StaticAlloc(blockSize));
+	}
+
+	StartWorkerThread(name, CORE_ANY, THREAD_NORMAL);
+	SignalWork();
+}
+
+/*
+===========================
+rvmMegaBakeReader::Shutdown
+===========================
+*/
+void rvmMegaBakeReader::Shutdown(void) {
+	if (IsRunning()) {
+		StopThread(true);
+	}
+
+	for (int i = 0; i < buffers.Num(); i++) {
+		R_StaticFree(buffers[i]);
+	}
+	buffers.Clear();
+	file = nullptr;
+}
+
+/*
+===========================
+rvmMegaBakeReader::NextBlock
+===========================
+*/
+const byte *rvmMegaBakeReader::NextBlock(int *length) {
+	uint64 startTime = Sys_Microseconds();
+
+	bool	ready;
+	bool	ended;
+	int		blockLength;
+
+	while (true) {
+		blockLock.Lock();
+		ready = numRead > numReleased;
+		ended = endBlock != -1 && numReleased > endBlock;
+		blockLength = (numReleased == endBlock) ? endLength : blockSize;
+		blockLock.Unlock();
+
+		if (ready || ended) {
+			break;
+		}
+		blockRead.Wait();
+	}
+
+	waitMicroseconds += Sys_Microseconds() - startTime;
+
+	if (length != nullptr) {
+		*length = ready ? blockLength : 0;
+	}
+	return ready ? buffers[numReleased % buffers.Num()] : nullptr;
+}
+
+/*
+===========================
+rvmMegaBakeReader::ReleaseBlock
+===========================
+*/
+void rvmMegaBakeReader::ReleaseBlock(void) {
+	blockLock.Lock();
+	numReleased++;
+	blockLock.Unlock();
+
+	// there is room for another block now
+	SignalWork();
+}
+
+/*
+===========================
+rvmMegaBakeReader::Run
+
+Reads until every buffer holds a block the bake hasn't released yet, ReleaseBlock wakes us up
+again. A short read leaves the rest of the block zeroed, like the old single read did with a
+truncated source, and is the last block read when there is no block count.
+===========================
+*/
+int rvmMegaBakeReader::Run(void) {
+	while (true) {
+		blockLock.Lock();
+		int blockNum = numRead;
+		bool full = (numBlocks >= 0 && blockNum >= numBlocks) || endBlock != -1 || blockNum >= numReleased + buffers.Num();
+		blockLock.Unlock();
+
+		if (full) {
+			return 0;
+		}
+
+		byte *buffer = buffers[blockNum % buffers.Num()];
+		int length = file->Read(buffer, blockSize);
+		if (length < blockSize) {
+			memset(buffer + Max(length, 0), 0, blockSize - Max(length, 0));
+		}
+
+		blockLock.Lock();
+		if (numBlocks < 0 && length < blockSize) {
+			endBlock = blockNum;
+			endLength = Max(length, 0);
+		}
+		numRead++;
+		blockLock.Unlock();
+
+		blockRead.Raise();
+	}
+}
+
+/*
+===========================
+rvmMegaBakeWriter::rvmMegaBakeWriter
+===========================
+*/
+rvmMegaBakeWriter::rvmMegaBakeWriter() {
+	file = nullptr;
+	current.buffer = nullptr;
+	numPending = 0;
+	waitMicroseconds = 0;
+}
+
+/*
+===========================
+rvmMegaBakeWriter::~rvmMegaBakeWriter
+===========================
+*/
+rvmMegaBakeWriter::~rvmMegaBakeWriter() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaBakeWriter::Start
+===========================
+*/
+void rvmMegaBakeWriter::Start(idFile *file, int bufferSize, int numBuffers, const char *name) {
+	Shutdown();
+
+	this->file = file;
+	numPending = 0;
+	waitMicroseconds = 0;
+
+	for (int i = 0; i < numBuffers; i++) {
+		buffers.Append((byte *)R_StaticAlloc(bufferSize));
+	}
+	freeBuffers = buffers;
+
+	StartWorkerThread(name, CORE_ANY, THREAD_NORMAL);
+}
+
+/*
+===========================
+rvmMegaBakeWriter::Shutdown
+===========================
+*/
+void rvmMegaBakeWriter::Shutdown(void) {
+	if (IsRunning()) {
+		Flush();
+		StopThread(true);
+	}
+
+	for (int i = 0; i < buffers.Num(); i++) {
+		R_StaticFree(buffers[i]);
+	}
+	buffers.Clear();
+	freeBuffers.Clear();
+	queuedWrites.Clear();
+	current.buffer = nullptr;
+	current.spans.Clear();
+	file = nullptr;
+}
+
+/*
+===========================
+rvmMegaBakeWriter::BeginWrite
+===========================
+*/
+byte *rvmMegaBakeWriter::BeginWrite(void) {
+	assert(current.buffer == nullptr);
+
+	uint64 startTime = Sys_Microseconds();
+
+	while (true) {
+		writeLock.Lock();
+		if (freeBuffers.Num() > 0) {
+			current.buffer = freeBuffers[freeBuffers.Num() - 1];
+			freeBuffers.RemoveIndex(freeBuffers.Num() - 1);
+		}
+		writeLock.Unlock();
+
+		if (current.buffer != nullptr) {
+			break;
+		}
+		writeDone.Wait();
+	}
+
+	waitMicroseconds += Sys_Microseconds() - startTime;
+	current.spans.Clear();
+	return current.buffer;
+}
+
+/*
+===========================
+rvmMegaBakeWriter::AddSpan
+===========================
+*/
+void rvmMegaBakeWriter::AddSpan(int64 fileOffset, int bufferOffset, int length) {
+	if (current.spans.Num() > 0) {
+		span_t &last = current.spans[current.spans.Num() - 1];
+
+		if (last.fileOffset + last.length == fileOffset && last.bufferOffset + last.length == bufferOffset) {
+			last.length += length;
+			return;
+		}
+	}
+
+	span_t &span = current.spans.Alloc();
+	span.fileOffset = fileOffset;
+	span.bufferOffset = bufferOffset;
+	span.length = length;
+}
+
+/*
+===========================
+rvmMegaBakeWriter::EndWrite
+===========================
+*/
+void rvmMegaBakeWriter::EndWrite(void) {
+	writeLock.Lock();
+	queuedWrites.Append(current);
+	numPending++;
+	writeLock.Unlock();
+
+	current.buffer = nullptr;
+	current.spans.Clear();
+
+	SignalWork();
+}
+
+/*
+===========================
+rvmMegaBakeWriter::Flush
+===========================
+*/
+void rvmMegaBakeWriter::Flush(void) {
+	uint64 startTime = Sys_Microseconds();
+
+	while (true) {
+		writeLock.Lock();
+		bool done = numPending == 0;
+		writeLock.Unlock();
+
+		if (done) {
+			break;
+		}
+		writeDone.Wait();
+	}
+
+	waitMicroseconds += Sys_Microseconds() - startTime;
+}
+
+/*
+===========================
+rvmMegaBakeWriter::Run
+
+Writes are done in the order they were queued, so a tile written twice ends up with the last
+one.
+===========================
+*/
+int rvmMegaBakeWriter::Run(void) {
+	while (true) {
+		writeLock.Lock();
+		if (queuedWrites.Num() == 0) {
+			writeLock.Unlock();
+			return 0;
+		}
+		write_t write = queuedWrites[0];
+		queuedWrites.RemoveIndex(0);
+		writeLock.Unlock();
+
+		for (int i = 0; i < write.spans.Num(); i++) {
+			const span_t &span = write.spans[i];
+
+			rvmMegaTextureFile::SeekFile(file, span.fileOffset);
+			file->Write(write.buffer + span.bufferOffset, span.length);
+		}
+
+		writeLock.Lock();
+		freeBuffers.Append(write.buffer);
+		numPending--;
+		writeLock.Unlock();
+
+		writeDone.Raise();
+	}
+}
@@ -0,0 +1,682 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+static const int MEGA_PATH_VERSION = 1;
+
+static idFile *							pathRecordFile = nullptr;
+static idList<const idMegaTexture *>	pathRecordMegaTextures;
+
+/*
+===========================
+rvmMegaTextureBench::RecordViewOrigin
+
+The first time a megatexture shows up in the recording its file and surface bounds are written,
+that is all a replay needs to turn the view origins back into texture centers.
+===========================
+*/
+void rvmMegaTextureBench::RecordViewOrigin(const idMegaTexture *megaTexture, const idVec3 &viewOrigin, int time) {
+	if (pathRecordFile == nullptr) {
+		return;
+	}
+
+	int megaNum = pathRecordMegaTextures.FindIndex(megaTexture);
+	if (megaNum == -1) {
+		const idBounds &bounds = megaTexture->surfaceBounds;
+
+		megaNum = pathRecordMegaTextures.Append(megaTexture);
+		pathRecordFile->Printf("mega %d \"%s\" %f %f %f %f %f %f\n", megaNum, megaTexture->albedoLitMegaTextureFile->GetName(),
+			bounds[0][0], bounds[0][1], bounds[0][2], bounds[1][0], bounds[1][1], bounds[1][2]);
+	}
+
+	pathRecordFile->Printf("frame %d %d %f %f %f\n", time, megaNum, viewOrigin[0], viewOrigin[1], viewOrigin[2]);
+}
+
+/*
+===========================
+rvmMegaTextureBench::RecordPath_f
+===========================
+*/
+void rvmMegaTextureBench::RecordPath_f(const idCmdArgs &args) {
+	if (pathRecordFile != nullptr) {
+		common->Printf("megaRecordPath: stopped recording %s\n", pathRecordFile->GetName());
+		delete pathRecordFile;
+		pathRecordFile = nullptr;
+		pathRecordMegaTextures.Clear();
+	}
+
+	if (args.Argc() < 2) {
+		return;
+	}
+
+	pathRecordFile = fileSystem->OpenFileWrite(args.Argv(1));
+	if (pathRecordFile == nullptr) {
+		common->Printf("megaRecordPath: couldn't open %s\n", args.Argv(1));
+		return;
+	}
+
+	pathRecordFile->Printf("megaPath %d\n", MEGA_PATH_VERSION);
+	common->Printf("megaRecordPath: recording to %s, megaRecordPath without a file name stops\n", args.Argv(1));
+}
+
+/*
+===========================
+rvmMegaTextureBench::LoadPath
+
+Pulls the frames for one megatexture out of a recording, the first one recorded unless megaName
+picks another.
+===========================
+*/
+bool rvmMegaTextureBench::LoadPath(const char *fileName, const char *megaName, idStr &megaFileName, idBounds &bounds, idList<pathFrame_t> &frames) {
+	char *buffer = nullptr;
+
+	if (fileSystem->ReadFile(fileName, (void **)&buffer) <= 0 || buffer == nullptr) {
+		common->Printf("megaBench: couldn't read %s\n", fileName);
+		return false;
+	}
+
+	int		version = 0;
+	int		megaNum = -1;
+
+	frames.Clear();
+
+	for (char *line = buffer; line != nullptr && *line != '\0'; ) {
+		char *next = strchr(line, '\n');
+		if (next != nullptr) {
+			*next++ = '\0';
+		}
+
+		char	name[MAX_OSPATH];
+		float	v[6];
+		int		num;
+		int		time;
+
+		if (sscanf(line, "megaPath %d", &version) == 1) {
+			// nothing else in the header yet
+		}
+		else if (sscanf(line, "mega %d \"%255[^\"]\" %f %f %f %f %f %f", &num, name, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 8) {
+			if (megaNum == -1 && (megaName == nullptr || idStr::FindText(name, megaName, false) != -1)) {
+				megaNum = num;
+				megaFileName = name;
+				for (int i = 0; i < 3; i++) {
+					bounds[0][i] = v[i];
+					bounds[1][i] = v[3 + i];
+				}
+			}
+		}
+		else if (sscanf(line, "frame %d %d %f %f %f", &time, &num, &v[0], &v[1], &v[2]) == 5) {
+			if (num == megaNum) {
+				pathFrame_t &frame = frames.Alloc();
+				frame.time = time;
+				frame.viewOrigin[0] = v[0];
+				frame.viewOrigin[1] = v[1];
+				frame.viewOrigin[2] = v[2];
+			}
+		}
+
+		line = next;
+	}
+
+	fileSystem->FreeFile(buffer);
+
+	if (version != MEGA_PATH_VERSION) {
+		common->Printf("megaBench: %s is not a version %d megaPath\n", fileName, MEGA_PATH_VERSION);
+		return false;
+	}
+	if (megaNum == -1 || frames.Num() == 0) {
+		common->Printf("megaBench: no frames for %s in %s\n", megaName != nullptr ? megaName : "any megatexture", fileName);
+		return false;
+	}
+	return true;
+}
+
+/*
+===========================
+rvmMegaTextureBench::MakeSyntheticPath
+
+A 60hz flight over the whole surface on a figure eight, it crosses the middle twice and changes
+direction all the time so both the window updates and the prefetcher get a workout.
+===========================
+*/
+void rvmMegaTextureBench::MakeSyntheticPath(int numFrames, idBounds &bounds, idList<pathFrame_t> &frames) {
+	static const float SURFACE_SIZE = 65536.0f;
+
+	bounds[0].Set(0.0f, 0.0f, 0.0f);
+	bounds[1].Set(SURFACE_SIZE, SURFACE_SIZE, 0.0f);
+
+	frames.SetNum(numFrames);
+	for (int i = 0; i < numFrames; i++) {
+		float t = idMath::TWO_PI * i / numFrames;
+
+		frames[i].time = i * 16;
+		frames[i].viewOrigin.Set((0.5f + 0.45f * idMath::Sin(t)) * SURFACE_SIZE, (0.5f + 0.45f * idMath::Sin(2.0f * t)) * SURFACE_SIZE, 256.0f);
+	}
+}
+
+/*
+===========================
+rvmMegaTextureBench::Replay
+
+Each frame does what idMegaTexture::BindForViewOrigin does minus the binding, and the time that
+takes on this thread is the frame's stall. Once the path is done everything still in flight gets
+to land so the totals cover the whole path.
+===========================
+*/
+void rvmMegaTextureBench::Replay(const char *megaFileName, const idBounds &bounds, const idList<pathFrame_t> &frames, bool realTime) {
+	static const int MAX_SETTLE_TIME = 10000;
+
+	rvmMegaTextureNullUploadBackend nullBackend;
+	rvmMegaTextureUploadBackend *oldBackend = rvmMegaTextureFile::GetUploadBackend();
+
+	rvmMegaTextureFile::SetUploadBackend(&nullBackend);
+
+	idMegaTexture *megaTexture = new idMegaTexture();
+	if (!megaTexture->InitForBenchmark(megaFileName, bounds)) {
+		common->Printf("megaBench: couldn't load %s\n", megaFileName);
+		delete megaTexture;
+		rvmMegaTextureFile::SetUploadBackend(oldBackend);
+		return;
+	}
+
+	rvmMegaTextureFile *mega = megaTexture->albedoLitMegaTextureFile;
+
+	// leave the pinned level uploads at load out of it
+	int loadUploads = nullBackend.numUploads;
+	nullBackend.ClearCounters();
+	mega->ClearStats();
+
+	uint64	startTime = Sys_Microseconds();
+	uint64	worstFrameTime = 0;
+	uint64	totalFrameTime = 0;
+	int		worstFrame = 0;
+	int		numMaskedFrames = 0;
+
+	for (int i = 0; i < frames.Num(); i++) {
+		const pathFrame_t &frame = frames[i];
+
+		if (realTime) {
+			uint64 due = startTime + (uint64)(frame.time - frames[0].time) * 1000;
+			uint64 now = Sys_Microseconds();
+			if (now < due) {
+				Sys_Sleep((int)((due - now) / 1000));
+			}
+		}
+
+		uint64 frameStart = Sys_Microseconds();
+
+		megaTexture->SetViewOrigin(frame.viewOrigin, frame.time);
+		mega->UploadCompletedTiles();
+
+		uint64 frameTime = Sys_Microseconds() - frameStart;
+		totalFrameTime += frameTime;
+		if (frameTime > worstFrameTime) {
+			worstFrameTime = frameTime;
+			worstFrame = i;
+		}
+
+		for (int j = 0; j < mega->numLevels; j++) {
+			if (!mega->levels[j].resident) {
+				numMaskedFrames++;
+				break;
+			}
+		}
+	}
+
+	uint64 replayTime = Sys_Microseconds() - startTime;
+
+	// let whatever is still streaming land
+	bool settled = false;
+	while (!settled && Sys_Microseconds() - startTime < replayTime + MAX_SETTLE_TIME * 1000) {
+		mega->UploadCompletedTiles();
+
+		settled = mega->streamer->IsIdle() && mega->pendingUploads.Num() == 0;
+		for (int j = 0; j < mega->numLevels && settled; j++) {
+			settled = mega->levels[j].resident;
+		}
+		if (!settled) {
+			Sys_Sleep(1);
+		}
+	}
+
+	uint64	totalTime = Sys_Microseconds() - startTime;
+	float	totalSeconds = Max(totalTime / 1000000.0f, 0.001f);
+	int		numStreamed = 0;
+	int		numStale = 0;
+
+	for (int j = 0; j < mega->numLevels; j++) {
+		numStreamed += mega->levels[j].stats.numUploads;
+		numStale += mega->levels[j].stats.numStale;
+	}
+
+	const megaFileStats_t &stats = mega->stats;
+	const rvmMegaTileCache &cache = mega->tileCache;
+	int lookups = cache.GetNumHits() + cache.GetNumMisses();
+
+	common->Printf("megaBench: %d frames of %s, %s, tile size %d, %d tiles per level, %s layout, %s\n", frames.Num(), megaFileName,
+		realTime ? "real time" : "as fast as possible", mega->tileSize, mega->tilesPerLevel,
+		mega->header.layout == MEGA_LAYOUT_MORTON ? "morton" : "linear", mega->header.compression == MEGA_COMPRESSION_ZLIB ? "zlib" : "uncompressed");
+	common->Printf("  time:    %.2f s replay, %.2f s to settle%s\n", replayTime / 1000000.0f, (totalTime - replayTime) / 1000000.0f, settled ? "" : " (gave up)");
+	common->Printf("  tiles:   %d streamed, %.1f tiles/sec, %d stale, %d at load\n", numStreamed, numStreamed / totalSeconds, numStale, loadUploads);
+	common->Printf("  reads:   %d tiles in %d reads, %.2f MB, %.2f MB/sec, %.2f ms reading\n", stats.numTileReads, stats.numReadCalls,
+		stats.numBytesRead / (1024.0f * 1024.0f), stats.numBytesRead / (1024.0f * 1024.0f) / totalSeconds, stats.readMicroseconds / 1000.0f);
+	common->Printf("  frames:  %.3f ms mean, %.3f ms worst (frame %d), %d frames with levels still masked\n",
+		totalFrameTime / 1000.0f / Max(frames.Num(), 1), worstFrameTime / 1000.0f, worstFrame, numMaskedFrames);
+	common->Printf("  cache:   %d hits %d misses (%.1f%% hit rate), %d staging overflows\n", cache.GetNumHits(), cache.GetNumMisses(),
+		lookups > 0 ? 100.0f * cache.GetNumHits() / lookups : 0.0f, mega->stagingPool.GetNumOverflows());
+	common->Printf("  uploads: %d tiles in %d batches, %d binds\n", nullBackend.numUploads, nullBackend.numBatches, nullBackend.numBinds);
+
+	delete megaTexture;
+	rvmMegaTextureFile::SetUploadBackend(oldBackend);
+}
+
+/*
+===========================
+rvmMegaTextureBench::Bench_f
+
+megaBench <path file> [mega <name>] [fast]
+megaBench synthetic mega <file> [frames <count>] [fast]
+===========================
+*/
+void rvmMegaTextureBench::Bench_f(const idCmdArgs &args) {
+	if (args.Argc() < 2) {
+		common->Printf("USAGE: megaBench <path file | synthetic> [mega <name>] [frames <count>] [fast]\n");
+		return;
+	}
+
+	const char *	megaName = nullptr;
+	int				numFrames = 3600;
+	bool			realTime = true;
+
+	for (int i = 2; i < args.Argc(); i++) {
+		if (!idStr::Icmp(args.Argv(i), "mega") && i + 1 < args.Argc()) {
+			megaName = args.Argv(++i);
+		}
+		else if (!idStr::Icmp(args.Argv(i), "frames") && i + 1 < args.Argc()) {
+			numFrames = Max(atoi(args.Argv(++i)), 1);
+		}
+		else if (!idStr::Icmp(args.Argv(i), "fast")) {
+			realTime = false;
+		}
+		else {
+			common->Printf("megaBench: unknown option %s\n", args.Argv(i));
+			return;
+		}
+	}
+
+	idStr				megaFileName;
+	idBounds			bounds;
+	idList<pathFrame_t>	frames;
+
+	if (!idStr::Icmp(args.Argv(1), "synthetic")) {
+		if (megaName == nullptr) {
+			common->Printf("megaBench: a synthetic path needs a megatexture, megaBench synthetic mega <file>\n");
+			return;
+		}
+		megaFileName = megaName;
+		MakeSyntheticPath(numFrames, bounds, frames);
+	}
+	else if (!LoadPath(args.Argv(1), megaName, megaFileName, bounds, frames)) {
+		return;
+	}
+
+	Replay(megaFileName.c_str(), bounds, frames, realTime);
+}
+
+/*
+===========================
+rvmMegaTextureBench::MakeSyntheticMegaTexture_f
+
+Writes a square megatexture with every level filled with made up DXT blocks. Each tile picks
+its blocks from a small palette so it deflates about as well as real terrain would, which keeps
+the compressed numbers honest. The contents are seeded off the tile number, so two builds always
+bench against the same bytes.
+===========================
+*/
+void rvmMegaTextureBench::MakeSyntheticMegaTexture_f(const idCmdArgs &args) {
+	static const int NUM_PALETTE_BLOCKS = 8;
+
+	if (args.Argc() != 3 && args.Argc() != 4) {
+		common->Printf("USAGE: makeSyntheticMegaTexture <filebase> <tiles wide> [tileSize]\n");
+		return;
+	}
+
+	int tilesWide = atoi(args.Argv(2));
+	if (!idMath::IsPowerOfTwo(tilesWide)) {
+		common->Printf("makeSyntheticMegaTexture: tiles wide must be a power of two\n");
+		return;
+	}
+
+	int tileSize = (args.Argc() == 4) ? atoi(args.Argv(3)) : DEFAULT_TILE_SIZE;
+	if (!idMath::IsPowerOfTwo(tileSize) || tileSize < MIN_TILE_SIZE || tileSize > MAX_TILE_SIZE) {
+		common->Printf("makeSyntheticMegaTexture: tileSize must be a power of two between %d and %d\n", MIN_TILE_SIZE, MAX_TILE_SIZE);
+		return;
+	}
+
+	idStr outName = "megaTextures/";
+	outName += args.Argv(1);
+	outName.StripFileExtension();
+	outName += ".mega";
+
+	bool	compress = idMegaTexture::r_megatexture_compress.GetBool();
+	idStr	rawName = outName;
+	if (compress) {
+		rawName.StripFileExtension();
+		rawName += "_raw.mega";
+	}
+
+	megaTextureHeader_t header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MEGA_FILE_MAGIC;
+	header.version = MEGA_FILE_VERSION;
+	header.compression = MEGA_COMPRESSION_NONE;
+	header.tileSize = tileSize;
+	header.tilesWide = tilesWide;
+	header.tilesHigh = tilesWide;
+	header.layout = idMegaTexture::r_megatexture_morton.GetBool() ? MEGA_LAYOUT_MORTON : MEGA_LAYOUT_LINEAR;
+
+	// tile 0 is the header, then every level down to a single tile
+	rvmMegaTextureFile::InitLevels(header);
+	int numTiles = header.numTiles;
+
+	idFile *out = fileSystem->OpenFileWrite(rawName.c_str());
+	if (out == nullptr) {
+		common->Printf("makeSyntheticMegaTexture: couldn't open %s\n", rawName.c_str());
+		return;
+	}
+
+	common->Printf("Writing %d synthetic tiles of %d to %s.\n", numTiles - 1, tileSize, rawName.c_str());
+
+	int		tileBytes = tileSize * tileSize;
+	byte	*tile = (byte *)R_StaticAlloc(tileBytes);
+
+	memset(tile, 0, tileBytes);
+	memcpy(tile, &header, sizeof(header));
+	out->Write(tile, tileBytes);
+
+	for (int tileNum = 1; tileNum < numTiles; tileNum++) {
+		idRandom	random(tileNum);
+		byte		palette[NUM_PALETTE_BLOCKS][16];
+
+		for (int i = 0; i < NUM_PALETTE_BLOCKS; i++) {
+			for (int j = 0; j < 16; j++) {
+				palette[i][j] = (byte)random.RandomInt(256);
+			}
+		}
+
+		for (int i = 0; i < tileBytes; i += 16) {
+			memcpy(&tile[i], palette[random.RandomInt(NUM_PALETTE_BLOCKS)], 16);
+		}
+		out->Write(tile, tileBytes);
+	}
+
+	R_StaticFree(tile);
+	delete out;
+
+	if (compress) {
+		if (!idMegaTexture::CompressMegaTexture(rawName.c_str(), outName.c_str(), idMegaTexture::r_megaTextureBuildThreads.GetInteger())) {
+			return;
+		}
+		fileSystem->RemoveFile(rawName.c_str());
+	}
+
+	common->Printf("Wrote %s.\n", outName.c_str());
+}
+
+/*
+===========================
+rvmMegaTextureBench::CopyBaseLevel
+
+Writes a raw file with just the base level of in, inflating it if need be, and hands it back
+still open for mip generation to carry on with.
+===========================
+*/
+idFile *rvmMegaTextureBench::CopyBaseLevel(rvmMegaTextureReader &in, const megaTextureHeader_t &header, const char *outName) {
+	idList<megaTileTableEntry_t> tileTable;
+	if (header.compression == MEGA_COMPRESSION_ZLIB && !rvmMegaTextureFile::ReadTileTable(in, header, tileTable)) {
+		common->Printf("megaMipBench: bad tile table\n");
+		return nullptr;
+	}
+
+	idFile *out = fileSystem->OpenFileWrite(outName);
+	if (out == nullptr) {
+		common->Printf("megaMipBench: couldn't open %s\n", outName);
+		return nullptr;
+	}
+
+	megaTextureHeader_t rawHeader = header;
+	rawHeader.version = MEGA_FILE_VERSION;
+	rawHeader.compression = MEGA_COMPRESSION_NONE;
+	rvmMegaTextureFile::InitLevels(rawHeader);
+
+	int		tileBytes = header.tileSize * header.tileSize;
+	byte	*tile = (byte *)R_StaticAlloc(tileBytes);
+	byte	*deflated = (byte *)R_StaticAlloc(tileBytes);
+
+	memset(tile, 0, tileBytes);
+	memcpy(tile, &rawHeader, sizeof(rawHeader));
+	out->Write(tile, tileBytes);
+
+	// the base level is the first thing after the header in either layout
+	int tileNum;
+	for (tileNum = 1; tileNum <= header.tilesWide * header.tilesHigh; tileNum++) {
+		bool tileOk;
+		if (header.compression == MEGA_COMPRESSION_ZLIB) {
+			// the table is validated, so entry.size never runs past deflated
+			const megaTileTableEntry_t &entry = tileTable[tileNum];
+
+			if (entry.size == tileBytes) {
+				tileOk = in.ReadAt(tile, entry.offset, tileBytes);
+			}
+			else {
+				tileOk = in.ReadAt(deflated, entry.offset, entry.size) && rvmMegaTextureFile::DecompressTile(deflated, entry.size, tile, tileBytes);
+			}
+		}
+		else {
+			tileOk = in.ReadAt(tile, (int64)tileNum * tileBytes, tileBytes);
+		}
+
+		if (!tileOk) {
+			common->Printf("megaMipBench: failed to read tile %d\n", tileNum);
+			break;
+		}
+		out->Write(tile, tileBytes);
+	}
+
+	R_StaticFree(tile);
+	R_StaticFree(deflated);
+
+	if (tileNum <= header.tilesWide * header.tilesHigh) {
+		delete out;
+		fileSystem->RemoveFile(outName);
+		return nullptr;
+	}
+	return out;
+}
+
+/*
+===========================
+rvmMegaTextureBench::HashMipLevels
+
+FNV-1a over every tile past the base level.
+===========================
+*/
+uint64 rvmMegaTextureBench::HashMipLevels(const char *fileName, const megaTextureHeader_t &header) {
+	static const int HASH_CHUNK = 1024 * 1024;
+
+	idFile *file = fileSystem->OpenFileRead(fileName);
+	if (file == nullptr) {
+		return 0;
+	}
+
+	int		tileBytes = header.tileSize * header.tileSize;
+	byte	*chunk = (byte *)R_StaticAlloc(HASH_CHUNK);
+	uint64	hash = 14695981039346656037ULL;
+	int		length;
+
+	rvmMegaTextureFile::SeekFile(file, (int64)(1 + header.tilesWide * header.tilesHigh) * tileBytes);
+	while ((length = file->Read(chunk, HASH_CHUNK)) > 0) {
+		for (int i = 0; i < length; i++) {
+			hash = (hash ^ chunk[i]) * 1099511628211ULL;
+		}
+	}
+
+	R_StaticFree(chunk);
+	delete file;
+	return hash;
+}
+
+/*
+===========================
+rvmMegaTextureBench::MipBench_f
+
+megaMipBench <file> [threads]
+
+Generates the mip levels of a megatexture single threaded and then on the encoder threads, from
+a scratch copy of its base level, and prints how long each level took both ways. The two builds
+have to come out identical.
+===========================
+*/
+void rvmMegaTextureBench::MipBench_f(const idCmdArgs &args) {
+	if (args.Argc() != 2 && args.Argc() != 3) {
+		common->Printf("USAGE: megaMipBench <file> [threads]\n");
+		return;
+	}
+
+	idStr fileName = "megaTextures/";
+	fileName += args.Argv(1);
+	fileName.StripFileExtension();
+	fileName += ".mega";
+
+	int numThreads = (args.Argc() == 3) ? atoi(args.Argv(2)) : idMegaTexture::r_megaTextureBuildThreads.GetInteger();
+
+	rvmMegaTextureReader in;
+	if (!in.Open(fileName.c_str())) {
+		common->Printf("megaMipBench: couldn't open %s\n", fileName.c_str());
+		return;
+	}
+
+	megaTextureHeader_t header;
+	byte headerData[sizeof(megaTextureHeader_t)];
+
+	if (!in.ReadAt(headerData, 0, sizeof(headerData)) || !rvmMegaTextureFile::ParseHeader(headerData, sizeof(headerData), header)) {
+		common->Printf("megaMipBench: bad header on %s\n", fileName.c_str());
+		return;
+	}
+
+	idStr scratchName = fileName;
+	scratchName.StripFileExtension();
+	scratchName += "_mipbench.mega";
+
+	idList<uint64>	levelTimes[2];
+	uint64			hashes[2];
+	int				threads[2] = { 1, numThreads };
+
+	for (int run = 0; run < 2; run++) {
+		idFile *out = CopyBaseLevel(in, header, scratchName.c_str());
+		if (out == nullptr) {
+			return;
+		}
+
+		idMegaTexture::GenerateMegaMipMaps(&header, out, threads[run], &levelTimes[run]);
+		delete out;
+
+		hashes[run] = HashMipLevels(scratchName.c_str(), header);
+	}
+
+	in.Close();
+	fileSystem->RemoveFile(scratchName.c_str());
+
+	common->Printf("megaMipBench: %s, %d x %d tiles of %d, %s threads\n", fileName.c_str(), header.tilesWide, header.tilesHigh, header.tileSize,
+		numThreads > 0 ? va("%d", numThreads) : "all");
+	common->Printf("  level    tiles    1 thread     threaded   speedup\n");
+
+	uint64	total[2] = { 0, 0 };
+	int		width = header.tilesWide;
+	int		height = header.tilesHigh;
+
+	for (int i = 0; i < levelTimes[0].Num() && i < levelTimes[1].Num(); i++) {
+		width = (width + 1) >> 1;
+		height = (height + 1) >> 1;
+		total[0] += levelTimes[0][i];
+		total[1] += levelTimes[1][i];
+
+		common->Printf("  %5d %8d %9.2f ms %9.2f ms %8.2fx\n", i + 1, width * height, levelTimes[0][i] / 1000.0f, levelTimes[1][i] / 1000.0f,
+			(float)levelTimes[0][i] / Max(levelTimes[1][i], (uint64)1));
+	}
+	common->Printf("  total          %9.2f ms %9.2f ms %8.2fx\n", total[0] / 1000.0f, total[1] / 1000.0f, (float)total[0] / Max(total[1], (uint64)1));
+
+	if (hashes[0] != hashes[1]) {
+		common->Warning("megaMipBench: the threaded mip levels don't match the single threaded ones");
+	}
+	else {
+		common->Printf("  mip levels identical\n");
+	}
+}
+
+/*
+===========================
+megaRecordPath
+===========================
+*/
+CONSOLE_COMMAND(megaRecordPath, "records the view origins megatextures are drawn from for megaBench, megaRecordPath [file]", 0) {
+	rvmMegaTextureBench::RecordPath_f(args);
+}
+
+/*
+===========================
+megaBench
+===========================
+*/
+CONSOLE_COMMAND(megaBench, "replays a megaRecordPath recording against a megatexture without uploading anything", 0) {
+	rvmMegaTextureBench::Bench_f(args);
+}
+
+/*
+===========================
+makeSyntheticMegaTexture
+===========================
+*/
+CONSOLE_COMMAND(makeSyntheticMegaTexture, "writes a megatexture full of made up tiles for megaBench", 0) {
+	rvmMegaTextureBench::MakeSyntheticMegaTexture_f(args);
+}
+
+/*
+===========================
+megaMipBench
+===========================
+*/
+CONSOLE_COMMAND(megaMipBench, "times mip generation for a megatexture single threaded against r_megaTextureBuildThreads", 0) {
+	rvmMegaTextureBench::MipBench_f(args);
+}
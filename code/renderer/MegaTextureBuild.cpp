@@ -34,12 +34,15 @@ If you have questions concerning this license or the applicable additional terms
 #include "tr_local.h"
 #include "DXT/DXTCodec.h"
 #include "Color/ColorSpace.h"
-
-// https://gist.github.com/Alhadis/455346f35286745d8562d24a8764dfa1
-#define ChannelBlend_Add(B,L)         ((byte)(min(255, (B + L))))
-#define ChannelBlend_Multiply(A,B)   ((byte)((A * B) / 255))
+#include "../libs/zlib/zlib.h"
 
 idCVar idMegaTexture::r_megatexture_ambient("r_megatexture_ambient", "20", CVAR_RENDERER | CVAR_INTEGER, "amount of lighting to add to the lit megatexture during building");
+idCVar idMegaTexture::r_megatexture_compress("r_megatexture_compress", "1", CVAR_RENDERER | CVAR_BOOL, "deflate the tiles of megatextures during building");
+idCVar idMegaTexture::r_megatexture_morton("r_megatexture_morton", "1", CVAR_RENDERER | CVAR_BOOL, "store the tiles of each megatexture level in Morton order during building, so windows of tiles are close together in the file");
+
+// source bands read ahead of the bake and encoded rows queued behind it
+static const int NUM_BAKE_READ_BUFFERS = 3;
+static const int NUM_BAKE_WRITE_BUFFERS = 3;
 
 static byte ReadByte(idFile *f) {
 	byte	b;
@@ -63,112 +66,93 @@ int RoundDownToPowerOfTwo(int num) {
 	return pot;
 }
 
-int R_GetTargaBPP(TargaHeader &header) {
-	switch (header.pixel_size)
-	{
-	case 8:
-		return 1;
-
-	case 24:
-		return 3;
-
-	case 32:
-		return 4;
-	}
-	common->FatalError("Mega GetTargetBPP: Unknown BPP\n");
-}
-
 /*
 ====================
 GenerateMegaMipMaps
+
+Rebuilds the mip levels of a raw megatexture from its base level. Each parent tile is filtered
+from its four children and encoded exactly once, a row of parents at a time over the encoder
+threads, while the children of the next row are read. A level is flushed before the level after
+it reads it back.
 ====================
 */
-void	idMegaTexture::GenerateMegaMipMaps(megaTextureHeader_t *header, idFile *outFile) {
+void	idMegaTexture::GenerateMegaMipMaps(const megaTextureHeader_t *header, idFile *outFile, int numThreads, idList<uint64> *levelMicroseconds) {
 	outFile->Flush();
 
 	// out fileSystem doesn't allow read / write access...
 	idFile	*inFile = fileSystem->OpenFileRead(outFile->GetName());
+	if (inFile == nullptr) {
+		common->Warning("GenerateMegaMipMaps: couldn't read back %s", outFile->GetName());
+		return;
+	}
 
-	int	tileOffset = 1;
-	int	width = header->tilesWide;
-	int	height = header->tilesHigh;
-
-	int		tileSize = header->tileSize * header->tileSize * 4;
-	int		tileSizeCompressed = header->tileSize * header->tileSize;
-	byte	*oldBlock = (byte *)_alloca(tileSize);
-	byte	*oldBlockCompressed = (byte *)_alloca(tileSizeCompressed);
-	byte	*newBlock = (byte *)_alloca(tileSize);
-	byte	*newBlockCompressed = (byte *)_alloca(tileSizeCompressed);
-
-	while (width > 1 || height > 1) {
-		int	newHeight = (height + 1) >> 1;
-		if (newHeight < 1) {
-			newHeight = 1;
-		}
-		int	newWidth = (width + 1) >> 1;
-		if (width < 1) {
-			width = 1;
-		}
-		common->Printf("generating %i x %i block mip level\n", newWidth, newHeight);
-
-		int		tileNum;
-
-		for (int y = 0; y < newHeight; y++) {
-			common->Printf("row %i\n", y);
-			session->UpdateScreen();
-
-			for (int x = 0; x < newWidth; x++) {
-				// mip map four original blocks down into a single new block
-				for (int yy = 0; yy < 2; yy++) {
-					for (int xx = 0; xx < 2; xx++) {
-						int	tx = x * 2 + xx;
-						int ty = y * 2 + yy;
-
-						if (tx > width || ty > height) {
-							// off edge, zero fill
-							memset(newBlock, 0, sizeof(newBlock));
-						}
-						else {
-							tileNum = tileOffset + ty * width + tx;
-							inFile->Seek(tileNum * tileSizeCompressed, FS_SEEK_SET);
-							inFile->Read(oldBlockCompressed, tileSizeCompressed);
-
-							idDxtDecoder decoder;
-							decoder.DecompressYCoCgDXT5(oldBlockCompressed, oldBlock, TILE_SIZE, TILE_SIZE);
-							//idColorSpace::ConvertCoCg_YToRGB(oldBlockCompressed, oldBlockCompressed, tileSize, tileSize);
-
-						//	R_WriteTGA("test.tga", (const byte *)oldBlock, TILE_SIZE, TILE_SIZE);
-						}
-						// mip map the new pixels
-						for (int yyy = 0; yyy < TILE_SIZE / 2; yyy++) {
-							for (int xxx = 0; xxx < TILE_SIZE / 2; xxx++) {
-								byte *in = &oldBlock[(yyy * 2 * TILE_SIZE + xxx * 2) * 4];
-								byte *out = &newBlock[(((TILE_SIZE / 2 * yy) + yyy) * TILE_SIZE + (TILE_SIZE / 2 * xx) + xxx) * 4];
-								out[0] = (in[0] + in[4] + in[0 + TILE_SIZE * 4] + in[4 + TILE_SIZE * 4]) >> 2;
-								out[1] = (in[1] + in[5] + in[1 + TILE_SIZE * 4] + in[5 + TILE_SIZE * 4]) >> 2;
-								out[2] = (in[2] + in[6] + in[2 + TILE_SIZE * 4] + in[6 + TILE_SIZE * 4]) >> 2;
-								out[3] = (in[3] + in[7] + in[3 + TILE_SIZE * 4] + in[7 + TILE_SIZE * 4]) >> 2;
-							}
-						}
-
-						// write the block out
-						tileNum = tileOffset + width * height + y * newWidth + x;
-
-
-						idDxtEncoder encoder;
-						//idColorSpace::ConvertRGBToCoCg_Y(newBlock, newBlock, TILE_SIZE, TILE_SIZE);
-						encoder.CompressYCoCgDXT5Fast((const byte *)newBlock, newBlockCompressed, TILE_SIZE, TILE_SIZE);
-						outFile->Seek(tileNum * tileSizeCompressed, FS_SEEK_SET);
-						outFile->Write(newBlockCompressed, tileSizeCompressed);
-					}
+	int		tileSize = header->tileSize;
+	int		tileSizeCompressed = tileSize * tileSize;
+
+	rvmMegaBakeWriter writer;
+	writer.Start(outFile, header->tilesWide * tileSizeCompressed, NUM_BAKE_WRITE_BUFFERS, "MegaBakeWriter");
+
+	rvmMegaTileEncoder encoder;
+	encoder.Init(*header, numThreads, &writer);
+
+	// the encoder still has the children of the row before
+	byte	*childTiles[2];
+	childTiles[0] = (byte *)R_StaticAlloc(2 * header->tilesWide * tileSizeCompressed);
+	childTiles[1] = (byte *)R_StaticAlloc(2 * header->tilesWide * tileSizeCompressed);
+
+	if (levelMicroseconds != nullptr) {
+		levelMicroseconds->Clear();
+	}
+
+	megaBuildLevel_t childLevel;
+	childLevel.tileOffset = 1;
+	childLevel.tilesWide = header->tilesWide;
+	childLevel.tilesHigh = header->tilesHigh;
+
+	while (childLevel.tilesWide > 1 || childLevel.tilesHigh > 1) {
+		megaBuildLevel_t level;
+		level.tileOffset = childLevel.tileOffset + childLevel.tilesWide * childLevel.tilesHigh;
+		level.tilesWide = (childLevel.tilesWide + 1) >> 1;
+		level.tilesHigh = (childLevel.tilesHigh + 1) >> 1;
+
+		common->Printf("generating %i x %i block mip level\n", level.tilesWide, level.tilesHigh);
+
+		uint64 startTime = Sys_Microseconds();
+
+		for (int y = 0; y < level.tilesHigh; y++) {
+			byte	*children = childTiles[y & 1];
+			int		childRows = Min(2, childLevel.tilesHigh - y * 2);
+
+			for (int yy = 0; yy < childRows; yy++) {
+				for (int tx = 0; tx < childLevel.tilesWide; tx++) {
+					int tileNum = childLevel.tileOffset + rvmMegaTextureFile::TileIndex(header->layout, childLevel.tilesWide, childLevel.tilesHigh, tx, y * 2 + yy);
+					rvmMegaTextureFile::SeekFile(inFile, (int64)tileNum * tileSizeCompressed);
+					inFile->Read(children + (yy * childLevel.tilesWide + tx) * tileSizeCompressed, tileSizeCompressed);
 				}
 			}
+
+			encoder.WriteRow();
+			encoder.EncodeMipRow(level, children, childLevel.tilesWide, childRows, y);
+		}
+
+		// the next level reads this one back
+		encoder.WriteRow();
+		writer.Flush();
+		outFile->Flush();
+
+		if (levelMicroseconds != nullptr) {
+			levelMicroseconds->Append(Sys_Microseconds() - startTime);
 		}
-		tileOffset += width * height;
-		width = newWidth;
-		height = newHeight;
+
+		childLevel = level;
 	}
 
+	encoder.Shutdown();
+	writer.Shutdown();
+
+	R_StaticFree(childTiles[0]);
+	R_StaticFree(childTiles[1]);
+
 	delete inFile;
 }
 
@@ -180,8 +164,8 @@ Make a 2k x 2k preview image for a mega texture that can be used in modeling pro
 ====================
 */
 void	idMegaTexture::GenerateMegaPreview(const char *fileName) {
-	idFile	*fileHandle = fileSystem->OpenFileRead(fileName);
-	if (!fileHandle) {
+	rvmMegaTextureReader reader;
+	if (!reader.Open(fileName)) {
 		common->Printf("idMegaTexture: failed to open %s\n", fileName);
 		return;
 	}
@@ -193,39 +177,60 @@ void	idMegaTexture::GenerateMegaPreview(const char *fileName) {
 	common->Printf("Creating %s.\n", outName.c_str());
 
 	megaTextureHeader_t header;
+	byte headerData[sizeof(megaTextureHeader_t)];
 
-	fileHandle->Read(&header, sizeof(header));
-	if (header.tileSize < 64 || header.tilesWide < 1 || header.tilesHigh < 1) {
+	if (!reader.ReadAt(headerData, 0, sizeof(headerData)) || !rvmMegaTextureFile::ParseHeader(headerData, sizeof(headerData), header)) {
 		common->Printf("idMegaTexture: bad header on %s\n", fileName);
 		return;
 	}
 
+	idList<megaTileTableEntry_t> tileTable;
+	if (header.compression == MEGA_COMPRESSION_ZLIB && !rvmMegaTextureFile::ReadTileTable(reader, header, tileTable)) {
+		common->Printf("idMegaTexture: bad tile table on %s\n", fileName);
+		return;
+	}
+
 	int	tileSize = header.tileSize;
-	int	width = header.tilesWide;
-	int	height = header.tilesHigh;
-	int	tileOffset = 1;
 	int	tileBytes = tileSize * tileSize;
+
 	// find the level that fits
-	while (width * tileSize > 2048 || height * tileSize > 2048) {
-		tileOffset += width * height;
-		width >>= 1;
-		if (width < 1) {
-			width = 1;
-		}
-		height >>= 1;
-		if (height < 1) {
-			height = 1;
-		}
+	int levelNum = 0;
+	while (levelNum < header.numLevels - 1 && (header.levels[levelNum].tilesWide * tileSize > 2048 || header.levels[levelNum].tilesHigh * tileSize > 2048)) {
+		levelNum++;
 	}
 
+	int	width = header.levels[levelNum].tilesWide;
+	int	height = header.levels[levelNum].tilesHigh;
+	int	tileOffset = header.levels[levelNum].firstTile;
+
 	byte *pic = (byte *)R_StaticAlloc(width * height * (tileBytes * 4));
-	byte	*oldBlock = (byte *)_alloca(tileBytes);
+	byte	*oldBlock = (byte *)R_StaticAlloc(tileBytes);
+	byte	*oldBlockDeflated = (byte *)R_StaticAlloc(tileBytes);
 	byte *oldBlockUncompressed = (byte *)R_StaticAlloc(tileSize * tileSize * 4);
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
-			int tileNum = tileOffset + y * width + x;
-			fileHandle->Seek(tileNum * tileBytes, FS_SEEK_SET);
-			fileHandle->Read(oldBlock, tileBytes);
+			int tileNum = tileOffset + rvmMegaTextureFile::TileIndex(header.layout, width, height, x, y);
+			bool tileOk;
+
+			// the tile table has already made sure no tile is bigger than tileBytes
+			if (header.compression == MEGA_COMPRESSION_ZLIB) {
+				const megaTileTableEntry_t &entry = tileTable[tileNum];
+
+				if (entry.size == tileBytes) {
+					tileOk = reader.ReadAt(oldBlock, entry.offset, tileBytes);
+				}
+				else {
+					tileOk = reader.ReadAt(oldBlockDeflated, entry.offset, entry.size) && rvmMegaTextureFile::DecompressTile(oldBlockDeflated, entry.size, oldBlock, tileBytes);
+				}
+			}
+			else {
+				tileOk = reader.ReadAt(oldBlock, (int64)tileNum * tileBytes, tileBytes);
+			}
+
+			if (!tileOk) {
+				common->Warning("GenerateMegaPreview: failed to read tile %d of %s\n", tileNum, fileName);
+				memset(oldBlock, 0, tileBytes);
+			}
 
 			idDxtDecoder decoder;
 			decoder.DecompressYCoCgDXT5(oldBlock, oldBlockUncompressed, tileSize, tileSize);
@@ -243,9 +248,120 @@ void	idMegaTexture::GenerateMegaPreview(const char *fileName) {
 	R_WriteTGA(outName.c_str(), pic, width * tileSize, height * tileSize, false);
 
 	R_StaticFree(oldBlockUncompressed);
+	R_StaticFree(oldBlockDeflated);
+	R_StaticFree(oldBlock);
 	R_StaticFree(pic);
+}
+
+/*
+====================
+CompressMegaTexture
+
+Deflates every tile of a freshly built megatexture into outName, with a table of where each
+tile ended up right after the header. The tiles stay in the order of the raw file, so the
+Morton layout and the levels following each other carry over. The raw file is read a row of
+tiles ahead, the tiles are deflated over the encoder threads and written behind.
+====================
+*/
+bool idMegaTexture::CompressMegaTexture(const char *rawName, const char *outName, int numThreads) {
+	idFile *inFile = fileSystem->OpenFileRead(rawName);
+	if (!inFile) {
+		common->Printf("idMegaTexture: failed to open %s\n", rawName);
+		return false;
+	}
+
+	megaTextureHeader_t header;
+	byte headerData[sizeof(megaTextureHeader_t)];
+
+	inFile->Read(headerData, sizeof(headerData));
+	if (!rvmMegaTextureFile::ParseHeader(headerData, sizeof(headerData), header) || header.compression != MEGA_COMPRESSION_NONE) {
+		common->Printf("idMegaTexture: bad header on %s\n", rawName);
+		delete inFile;
+		return false;
+	}
+
+	int tileBytes = header.tileSize * header.tileSize;
+
+	// the tile count comes from the levels, a file past 2 GB has no idFile length to go by
+	header.magic = MEGA_FILE_MAGIC;
+	header.version = MEGA_FILE_VERSION;
+	header.compression = MEGA_COMPRESSION_ZLIB;
+	rvmMegaTextureFile::InitLevels(header);
+
+	idList<megaTileTableEntry_t> tileTable;
+	tileTable.SetNum(header.numTiles);
+	memset(tileTable.Ptr(), 0, tileTable.Num() * sizeof(megaTileTableEntry_t));
+
+	common->Printf("Compressing %d tiles to %s.\n", header.numTiles - 1, outName);
+
+	idFile *outFile = fileSystem->OpenFileWrite(outName);
+	if (!outFile) {
+		common->Printf("idMegaTexture: failed to open %s\n", outName);
+		delete inFile;
+		return false;
+	}
+
+	uint64	startTime = Sys_Microseconds();
+
+	// the table gets filled in once we know where everything went
+	outFile->Write(&header, sizeof(header));
+	outFile->Write(tileTable.Ptr(), tileTable.Num() * sizeof(megaTileTableEntry_t));
+
+	// tile 0 is the header, the rest are read a row's worth at a time
+	int		tilesPerBlock = header.tilesWide;
+	int		numBlocks = (header.numTiles - 1 + tilesPerBlock - 1) / tilesPerBlock;
+
+	rvmMegaTextureFile::SeekFile(inFile, tileBytes);
+
+	rvmMegaBakeReader reader;
+	reader.Start(inFile, tilesPerBlock * tileBytes, numBlocks, NUM_BAKE_READ_BUFFERS, "MegaCompressReader");
+
+	rvmMegaBakeWriter writer;
+	writer.Start(outFile, tilesPerBlock * rvmMegaTileEncoder::GetDeflateBound(header.tileSize), NUM_BAKE_WRITE_BUFFERS, "MegaCompressWriter");
+
+	rvmMegaTileEncoder encoder;
+	encoder.Init(header, numThreads, &writer);
+	numThreads = encoder.GetNumThreads();
+
+	// idFile::Tell is an int as well, so keep track of where we are ourselves
+	int64	outOffset = sizeof(header) + (int64)tileTable.Num() * sizeof(megaTileTableEntry_t);
+
+	for (int firstTile = 1; firstTile < header.numTiles; firstTile += tilesPerBlock) {
+		int numTiles = Min(tilesPerBlock, header.numTiles - firstTile);
+
+		common->Printf("%i tilesRemaining\n", header.numTiles - firstTile);
+		session->UpdateScreen();
+
+		encoder.DeflateRow(reader.NextBlock(), numTiles, &tileTable[firstTile], outOffset);
+		encoder.WriteRow();
+		reader.ReleaseBlock();
+
+		const megaTileTableEntry_t &last = tileTable[firstTile + numTiles - 1];
+		outOffset = last.offset + last.size;
+	}
+
+	encoder.Shutdown();
+	writer.Shutdown();
+	reader.Shutdown();
+
+	// tiles go out in order, so a level starts where its first tile does
+	for (int i = 0; i < header.numLevels; i++) {
+		header.levels[i].offset = tileTable[header.levels[i].firstTile].offset;
+	}
+
+	outFile->Seek(0, FS_SEEK_SET);
+	outFile->Write(&header, sizeof(header));
+	outFile->Write(tileTable.Ptr(), tileTable.Num() * sizeof(megaTileTableEntry_t));
+
+	int64 compressedTotal = outOffset - (sizeof(header) + (int64)tileTable.Num() * sizeof(megaTileTableEntry_t));
+	common->Printf("Compressed %lld KB of tiles to %lld KB in %.1f seconds on %d threads, %.1f waiting on reads and %.1f on writes.\n",
+		(int64)(header.numTiles - 1) * (tileBytes / 1024), compressedTotal / 1024, (Sys_Microseconds() - startTime) / 1000000.0f, numThreads,
+		reader.GetWaitMicroseconds() / 1000000.0f, writer.GetWaitMicroseconds() / 1000000.0f);
+
+	delete outFile;
+	delete inFile;
 
-	delete fileHandle;
+	return true;
 }
 
 /*
@@ -317,65 +433,29 @@ idFile *idMegaTexture::LoadTGA(const char *name, TargaHeader &targa_header, int
 idMegaTexture::ProcessTGABlock
 ====================
 */
-void idMegaTexture::ProcessTGABlock(rvmMegaTextureSourceFile_t *file, byte *targa_rgba, TargaHeader	&targa_header, int columns, int rows, int scale)
+void idMegaTexture::ProcessTGABlock(const byte *data, byte *targa_rgba, TargaHeader	&targa_header, int columns, int rows, int scale, int tileSize)
 {
-	int		row, column;
+	int		row;
 	byte	*pixbuf;
 	byte	*startRowPixBuf;
 	
-	if (targa_header.image_type == 2 || targa_header.image_type == 3) {
-		// Uncompressed RGB or gray scale image
-		for (row = 0; row < TILE_SIZE * scale; row++) {
+	// run length encoded bands come in already expanded by rvmMegaTGABandReader
+	if (targa_header.image_type == 2 || targa_header.image_type == 3 || targa_header.image_type == 10) {
+		// Uncompressed RGB or gray scale image, a whole row at a time
+		megaTGARowDecoder_t decodeRow = R_GetTGARowDecoder(targa_header.pixel_size, scale);
+		if (decodeRow == nullptr) {
+			common->Error("LoadTGA: illegal pixel_size '%d'\n", targa_header.pixel_size);
+		}
+
+		int rowBytes = columns * (targa_header.pixel_size >> 3);
+
+		for (row = 0; row < tileSize * scale; row++) {
 			pixbuf = targa_rgba + row * (columns * scale) * 4;
 			startRowPixBuf = pixbuf;
 
-			for (column = 0; column < columns; column++) {
-				unsigned char red, green, blue, alphabyte;
-				switch (targa_header.pixel_size) {
-				case 8:
-					blue = file->ReadByte();
-					green = blue;
-					red = blue;
-
-					for (int f = 0; f < scale; f++)
-					{
-						*pixbuf++ = red;
-						*pixbuf++ = green;
-						*pixbuf++ = blue;
-						*pixbuf++ = 255;
-					}
-					break;
-
-				case 24:
-					blue = file->ReadByte();
-					green = file->ReadByte();
-					red = file->ReadByte();
-					for (int f = 0; f < scale; f++)
-					{
-						*pixbuf++ = red;
-						*pixbuf++ = green;
-						*pixbuf++ = blue;
-						*pixbuf++ = 255;
-					}
-					break;
-				case 32:
-					blue = file->ReadByte();
-					green = file->ReadByte();
-					red = file->ReadByte();
-					alphabyte = file->ReadByte();
-					for (int f = 0; f < scale; f++)
-					{
-						*pixbuf++ = red;
-						*pixbuf++ = green;
-						*pixbuf++ = blue;
-						*pixbuf++ = alphabyte;
-					}
-					break;
-				default:
-					common->Error("LoadTGA: illegal pixel_size '%d'\n", targa_header.pixel_size);
-					break;
-				}
-			}
+			decodeRow(data, pixbuf, columns, scale);
+			data += rowBytes;
+			pixbuf += columns * scale * 4;
 
 			// If we are scaling, just duplicate the row!
 			int scale_loop = scale;
@@ -391,10 +471,45 @@ void idMegaTexture::ProcessTGABlock(rvmMegaTextureSourceFile_t *file, byte *targ
 			}
 		}
 	}
-	else if (targa_header.image_type == 10) {   // Runlength encoded RGB images
-		// jmarshall: I'm not supporting RLE so we can pre-load as much as the image as possible off disc during baking.
-		common->FatalError("MegaTexture ProcessTGABlock: RLE not supported!");
-	}
+}
+
+/*
+====================
+rvmMegaTGABakeSource::Open
+====================
+*/
+bool rvmMegaTGABakeSource::Open(const char *name) {
+	source.file = idMegaTexture::LoadTGA(name, source.targa_header, source.columns, source.rows, source.fileSize, source.numBytes);
+	return source.file != nullptr;
+}
+
+/*
+====================
+rvmMegaTGABakeSource::Start
+====================
+*/
+void rvmMegaTGABakeSource::Start(int bandRows, int numBands) {
+	this->bandRows = bandRows;
+	reader.Start(source.file, source.targa_header, bandRows, numBands, NUM_BAKE_READ_BUFFERS, "MegaBakeAlbedoReader");
+}
+
+/*
+====================
+rvmMegaTGABakeSource::Shutdown
+====================
+*/
+void rvmMegaTGABakeSource::Shutdown(void) {
+	reader.Shutdown();
+}
+
+/*
+====================
+rvmMegaTGABakeSource::ReadBand
+====================
+*/
+void rvmMegaTGABakeSource::ReadBand(byte *rgba) {
+	idMegaTexture::ProcessTGABlock(reader.NextBand(), rgba, source.targa_header, source.columns, source.rows, 1, bandRows);
+	reader.ReleaseBand();
 }
 
 /*
@@ -405,123 +520,181 @@ Incrementally load a giant tga file and process into the mega texture block form
 ====================
 */
 void idMegaTexture::MakeMegaTexture_f(const idCmdArgs &args) {
-	rvmMegaTextureSourceFile_t albedoSource, litSource;
-
-	if (args.Argc() != 2) {
-		common->Printf("USAGE: makeMegaTexture <filebase>\n");
+	if (args.Argc() != 2 && args.Argc() != 3) {
+		common->Printf("USAGE: makeMegaTexture <filebase> [tileSize]\n");
 		return;
 	}
 
-	idStr	name = "megaTextures/";
-	name += args.Argv(1);
-	name.StripFileExtension();
-	name += ".tga";
+	int tileSize = DEFAULT_TILE_SIZE;
+	if (args.Argc() == 3) {
+		tileSize = atoi(args.Argv(2));
+		if (!idMath::IsPowerOfTwo(tileSize) || tileSize < MIN_TILE_SIZE || tileSize > MAX_TILE_SIZE) {
+			common->Printf("makeMegaTexture: tileSize must be a power of two between %d and %d\n", MIN_TILE_SIZE, MAX_TILE_SIZE);
+			return;
+		}
+	}
 
 	idStr	albedoName = "megagen/bin/";
 	albedoName += args.Argv(1);
 	albedoName.StripFileExtension();
 	albedoName += ".tga";
 
+	rvmMegaTGABakeSource albedoSource;
+	if (!albedoSource.Open(albedoName)) {
+		return;
+	}
+
+	BakeMegaTexture(args.Argv(1), &albedoSource, tileSize);
+}
+
+/*
+====================
+BakeMegaTexture
+
+Lights the albedo rows as they come in with the lightmap, and encodes them and their mips into
+the mega texture block format.
+====================
+*/
+bool idMegaTexture::BakeMegaTexture(const char *baseName, rvmMegaBakeSource *albedoSource, int tileSize) {
+	rvmMegaTextureSourceFile_t litSource;
+
+	idStr	name = "megaTextures/";
+	name += baseName;
+	name.StripFileExtension();
+	name += ".tga";
+
 	idStr	lit_name = "megaTextures/";
-	lit_name += args.Argv(1);
+	lit_name += baseName;
 	lit_name.StripFileExtension();
 	lit_name += "_lit.tga";
 
-	albedoSource.file = idMegaTexture::LoadTGA(albedoName, albedoSource.targa_header, albedoSource.columns, albedoSource.rows, albedoSource.fileSize, albedoSource.numBytes);
-	if (albedoSource.file == nullptr)
-		return;
-
 	litSource.file = idMegaTexture::LoadTGA(lit_name, litSource.targa_header, litSource.columns, litSource.rows, litSource.fileSize, litSource.numBytes);
 	if (litSource.file == nullptr)
-		return;
+		return false;
+
+	int albedoWidth = albedoSource->GetWidth();
+	int albedoHeight = albedoSource->GetHeight();
+
+	// the lightmap is scaled up a whole number of times to the albedo, the compose assumes it
+	// lines up with it exactly
+	int litWidth = litSource.targa_header.width;
+	if (litWidth <= 0 || litWidth > albedoWidth || albedoWidth % litWidth != 0) {
+		common->Warning("makeMegaTexture: %s is %d wide, which doesn't scale up to the %d wide albedo", lit_name.c_str(), litWidth, albedoWidth);
+		delete litSource.file;
+		litSource.file = nullptr;
+		return false;
+	}
 
 	megaTextureHeader_t		mtHeader;
 
-	mtHeader.tileSize = TILE_SIZE;
-	mtHeader.tilesWide = RoundDownToPowerOfTwo(albedoSource.targa_header.width) / TILE_SIZE;
-	mtHeader.tilesHigh = RoundDownToPowerOfTwo(albedoSource.targa_header.height) / TILE_SIZE;
+	memset(&mtHeader, 0, sizeof(mtHeader));
+	mtHeader.magic = MEGA_FILE_MAGIC;
+	mtHeader.version = MEGA_FILE_VERSION;
+	mtHeader.compression = MEGA_COMPRESSION_NONE;
+	mtHeader.tileSize = tileSize;
+	mtHeader.tilesWide = RoundDownToPowerOfTwo(albedoWidth) / tileSize;
+	mtHeader.tilesHigh = RoundDownToPowerOfTwo(albedoHeight) / tileSize;
+
+	// a source smaller than a tile has nothing to bake, and would walk InitLevels through empty levels
+	if (mtHeader.tilesWide < 1 || mtHeader.tilesHigh < 1) {
+		common->Warning("makeMegaTexture: %d x %d is smaller than a %d pixel tile", albedoWidth, albedoHeight, tileSize);
+		delete litSource.file;
+		litSource.file = nullptr;
+		return false;
+	}
+
+	mtHeader.layout = r_megatexture_morton.GetBool() ? MEGA_LAYOUT_MORTON : MEGA_LAYOUT_LINEAR;
+	rvmMegaTextureFile::InitLevels(mtHeader);
 
 	idStr	outName = name;
 	outName.StripFileExtension();
 	outName += ".mega";
 
-	common->Printf("Writing %i x %i size %i tiles to %s.\n", mtHeader.tilesWide, mtHeader.tilesHigh, mtHeader.tileSize, outName.c_str());
+	// when compressing, the tiles are built at fixed offsets first, which is what puts them in
+	// Morton order, and deflated over the encoder threads in a pass of their own
+	bool	compress = r_megatexture_compress.GetBool();
+	idStr	rawName = outName;
+	if (compress) {
+		rawName.StripFileExtension();
+		rawName += "_raw.mega";
+	}
+
+	common->Printf("Writing %i x %i size %i tiles to %s.\n", mtHeader.tilesWide, mtHeader.tilesHigh, mtHeader.tileSize, rawName.c_str());
+
+	uint64	bakeStartTime = Sys_Microseconds();
 
 	// open the output megatexture file
-	idFile	*out = fileSystem->OpenFileWrite(outName.c_str());
+	idFile	*out = fileSystem->OpenFileWrite(rawName.c_str());
+	if (out == nullptr) {
+		common->Printf("makeMegaTexture: couldn't open %s\n", rawName.c_str());
+		return false;
+	}
 
 	out->Write(&mtHeader, sizeof(mtHeader));
-	out->Seek(TILE_SIZE * TILE_SIZE, FS_SEEK_SET);
 
 	// we will process this one row of tiles at a time, since the entire thing
 	// won't fit in memory
-	byte	*targa_rgba = (byte *)R_StaticAlloc(TILE_SIZE * albedoSource.targa_header.width * 4);	
-	byte	*targa_compose = (byte *)R_StaticAlloc(TILE_SIZE * albedoSource.targa_header.width * 4);
-
-	int len = (TILE_SIZE * TILE_SIZE + 1) * 4;
-	byte *megaMemory = (byte *)Mem_Alloc(len);
-	//idFile_Memory *megaMemoryTile = new idFile_Memory("mega_memory", (char *)megaMemory, len);
+	// one row is decoded while the encoder is still composing the one before it
+	byte	*targa_rgba[2];
+	targa_rgba[0] = (byte *)R_StaticAlloc(tileSize * albedoWidth * 4);
+	targa_rgba[1] = (byte *)R_StaticAlloc(tileSize * albedoWidth * 4);
 
-	int currentMegaTilePosition = 0;
-	byte *megaMemoryTile = new byte[len];
+	// encoded rows are written behind the bake
+	rvmMegaBakeWriter writer;
+	writer.Start(out, mtHeader.tilesWide * tileSize * tileSize, NUM_BAKE_WRITE_BUFFERS, "MegaBakeWriter");
 
-	byte *compressed_tile_buffer = (byte *)R_StaticAlloc(TILE_SIZE * TILE_SIZE);
+	rvmMegaTileEncoder encoder;
+	encoder.Init(mtHeader, r_megaTextureBuildThreads.GetInteger(), &writer);
+	common->Printf("Encoding tiles on %d threads.\n", encoder.GetNumThreads());
 
-	int albedoSourcebpp = R_GetTargaBPP(albedoSource.targa_header);
-	int litSourcebpp = R_GetTargaBPP(litSource.targa_header);
+	// the mip levels come straight out of the composed tiles as they go by
+	rvmMegaMipBuilder mipBuilder;
+	mipBuilder.Init(mtHeader, &encoder);
 
-	int albedoSourceLen = (albedoSource.columns * albedoSourcebpp);
-	albedoSourceLen = albedoSourceLen * TILE_SIZE;
+	megaBuildLevel_t baseLevel;
+	baseLevel.tileOffset = 1;
+	baseLevel.tilesWide = mtHeader.tilesWide;
+	baseLevel.tilesHigh = mtHeader.tilesHigh;
 
-	int litSourceLen = (litSource.columns * litSourcebpp);
-	litSourceLen = litSourceLen * TILE_SIZE;
-
-	albedoSource.AllocScratch(albedoSourceLen);
-
-	int numLitBlocksToSkip = albedoSource.targa_header.width / litSource.targa_header.width;
+	int numLitBlocksToSkip = albedoWidth / litWidth;
 	int litSkippedBlocks = 0;
 
+	// Do single big reads of whole bands, small byte reads off disc are just slow. They are read
+	// ahead on their own threads while the bake decodes and encodes what it has. Run length
+	// encoded sources are read compressed and expanded a band at a time.
+	rvmMegaTGABandReader litReader;
+	albedoSource->Start(tileSize, mtHeader.tilesHigh);
+	litReader.Start(litSource.file, litSource.targa_header, tileSize, (mtHeader.tilesHigh + numLitBlocksToSkip - 1) / numLitBlocksToSkip, NUM_BAKE_READ_BUFFERS, "MegaBakeLitReader");
+
 	// Lit source will contain numLitBlocksToSkip if we are scaling!
-	litSource.AllocScratch(litSourceLen);
-	byte	*targa_lit = new byte[((TILE_SIZE* numLitBlocksToSkip) * albedoSource.targa_header.width) * 4];
+	byte	*targa_lit[2];
+	targa_lit[0] = new byte[((tileSize* numLitBlocksToSkip) * albedoWidth) * 4];
+	targa_lit[1] = new byte[((tileSize* numLitBlocksToSkip) * albedoWidth) * 4];
+	int		litBuffer = 1;
 
 	int blockRowsRemaining = mtHeader.tilesHigh;
 	while (blockRowsRemaining--) {
+		int tileRow = mtHeader.tilesHigh - 1 - blockRowsRemaining;
+		byte *albedo = targa_rgba[tileRow & 1];
+
 		common->Printf("%i blockRowsRemaining\n", blockRowsRemaining);
 		session->UpdateScreen();
 
-		// Do a single big read here, small byte reads off disc are just slow.
-		albedoSource.file->Read(albedoSource.scratch, albedoSourceLen);
-		
 		// Process the lit and albedo source images.
-		albedoSource.ResetScratch();
-		ProcessTGABlock(&albedoSource, targa_rgba, albedoSource.targa_header, albedoSource.columns, albedoSource.rows, 1);
+		albedoSource->ReadBand(albedo);
 
 
 		// Only load litSource if we need another block.
 		if (numLitBlocksToSkip == 1 || litSkippedBlocks == 0)
 		{
-			litSource.file->Read(litSource.scratch, litSourceLen);
-
-			litSource.ResetScratch();
-			ProcessTGABlock(&litSource, targa_lit, litSource.targa_header, litSource.columns, litSource.rows, numLitBlocksToSkip);
+			// the encoder may still be lighting the row before with the other one
+			litBuffer ^= 1;
+			ProcessTGABlock(litReader.NextBand(), targa_lit[litBuffer], litSource.targa_header, litSource.columns, litSource.rows, numLitBlocksToSkip, tileSize);
+			litReader.ReleaseBand();
 		}
 
 		// This is to support MegaLight not outputing lightmaps 1:1 with the size of the megatexture albedo.
-		int lightmap_start = ((TILE_SIZE * albedoSource.targa_header.width)) * litSkippedBlocks; //litSourceLen * litSkippedBlocks;
-		for (int i = 0; i < TILE_SIZE * albedoSource.targa_header.width; i++)
-		{
-			int lightmapPosition = lightmap_start + i;
-
-			byte litR = ChannelBlend_Add(targa_lit[(lightmapPosition * 4) + 0], r_megatexture_ambient.GetInteger());
-			byte litG = ChannelBlend_Add(targa_lit[(lightmapPosition * 4) + 1], r_megatexture_ambient.GetInteger());
-			byte litB = ChannelBlend_Add(targa_lit[(lightmapPosition * 4) + 2], r_megatexture_ambient.GetInteger());
-
-			targa_compose[(i * 4) + 0] = ChannelBlend_Multiply(targa_rgba[(i * 4) + 0], litR);
-			targa_compose[(i * 4) + 1] = ChannelBlend_Multiply(targa_rgba[(i * 4) + 1], litG);
-			targa_compose[(i * 4) + 2] = ChannelBlend_Multiply(targa_rgba[(i * 4) + 2], litB);
-			targa_compose[(i * 4) + 3] = 255;
-		}
+		const byte *lit = targa_lit[litBuffer] + tileSize * albedoWidth * litSkippedBlocks * 4;
 
 		if (litSkippedBlocks >= numLitBlocksToSkip - 1) {
 			litSkippedBlocks = 0;
@@ -530,50 +703,55 @@ void idMegaTexture::MakeMegaTexture_f(const idCmdArgs &args) {
 			litSkippedBlocks++;
 		}
 
-		//
-		// write out individual blocks from the full row block buffer
-		//
-		for (int rowBlock = 0; rowBlock < mtHeader.tilesWide; rowBlock++) {
-			idDxtEncoder encoder;
-
-			//megaMemoryTile->Seek(0, FS_SEEK_SET);
-			currentMegaTilePosition = 0;
-			for (int y = 0; y < TILE_SIZE; y++) {
-				memcpy(&megaMemoryTile[currentMegaTilePosition], targa_compose + (y * albedoSource.targa_header.width + rowBlock * TILE_SIZE) * 4, TILE_SIZE * 4);
-				currentMegaTilePosition += TILE_SIZE * 4;
-			}
-
-			int fileWriteAddress = out->Tell();
-
-			// convert the image data to YCoCg and use the YCoCgDXT5 compressor
-			idColorSpace::ConvertRGBToCoCg_Y((byte *)megaMemoryTile, (byte *)megaMemoryTile, TILE_SIZE, TILE_SIZE);
+		// write out the row before this one, along with any mip rows it finished
+		if (tileRow > 0) {
+			encoder.WriteRow();
+			mipBuilder.EndBaseRow();
+			encoder.WriteRow();
+		}
 
-			encoder.CompressYCoCgDXT5Fast_Generic((const byte *)megaMemoryTile, compressed_tile_buffer, TILE_SIZE, TILE_SIZE);
+		// the encoder lights, gathers and mips the tiles of this one in a single pass
+		int		mipWidth;
+		byte	*mipRows = mipBuilder.BeginBaseRow(mipWidth);
+		encoder.EncodeBaseRow(baseLevel, albedo, lit, albedoWidth, r_megatexture_ambient.GetInteger(), mipRows, mipWidth, tileRow);
+	}
 
-			//{
-			//	idDxtDecoder decoder;
-			//	byte *uncompress_test_me = (byte *)_alloca(TILE_SIZE * TILE_SIZE * 4);
-			//	
-			//	decoder.DecompressImageDXT5(compressed_tile_buffer, uncompress_test_me, TILE_SIZE, TILE_SIZE);
-			//	R_WriteTGA("test_compression.tga", uncompress_test_me, TILE_SIZE, TILE_SIZE);
-			//}
+	encoder.WriteRow();
+	mipBuilder.EndBaseRow();
+	mipBuilder.Finish();
+	encoder.WriteRow();
 
-			out->Write(compressed_tile_buffer, TILE_SIZE * TILE_SIZE);
-		}
-	}
+	mipBuilder.Shutdown();
+	encoder.Shutdown();
+	writer.Shutdown();
+	albedoSource->Shutdown();
+	litReader.Shutdown();
 
-	delete megaMemoryTile;
-	delete targa_lit;
+	common->Printf("Encoded in %.1f seconds, %.1f waiting on reads and %.1f on writes.\n", (Sys_Microseconds() - bakeStartTime) / 1000000.0f,
+		(albedoSource->GetWaitMicroseconds() + litReader.GetWaitMicroseconds()) / 1000000.0f, writer.GetWaitMicroseconds() / 1000000.0f);
+	common->Printf("Read %lld MB of source for %lld MB of pixels.\n", (albedoSource->GetSourceBytes() + litReader.GetSourceBytes()) / (1024 * 1024),
+		(albedoSource->GetBandBytes() + litReader.GetBandBytes()) / (1024 * 1024));
 
-	R_StaticFree(targa_rgba);
-	R_StaticFree(targa_compose);
-	R_StaticFree(compressed_tile_buffer);
+	delete[] targa_lit[0];
+	delete[] targa_lit[1];
 
-	GenerateMegaMipMaps(&mtHeader, out);
+	R_StaticFree(targa_rgba[0]);
+	R_StaticFree(targa_rgba[1]);
 
 	delete out;
-	delete albedoSource.file;
 	delete litSource.file;
+	litSource.file = nullptr;
+
+	if (compress) {
+		if (!CompressMegaTexture(rawName.c_str(), outName.c_str(), r_megaTextureBuildThreads.GetInteger())) {
+			return false;
+		}
+		fileSystem->RemoveFile(rawName.c_str());
+	}
+
+	// the whole bake, compression included
+	uint64 bakeTime = Sys_Microseconds() - bakeStartTime;
+	common->Printf("Baked %s in %.1f seconds.\n", outName.c_str(), bakeTime / 1000000.0f);
 
 	GenerateMegaPreview(outName.c_str());
 #if 0
@@ -582,6 +760,7 @@ void idMegaTexture::MakeMegaTexture_f(const idCmdArgs &args) {
 	}
 #endif
 
+	return true;
 }
 
 
@@ -0,0 +1,212 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+#include <limits.h>
+
+idCVar idMegaTexture::r_megaTextureCacheSize("r_megaTextureCacheSize", "64", CVAR_RENDERER | CVAR_INTEGER, "size in megabytes of the compressed tile cache for each megatexture, 0 disables it");
+
+/*
+===========================
+rvmMegaTileCache::rvmMegaTileCache
+===========================
+*/
+rvmMegaTileCache::rvmMegaTileCache() {
+	tileBytes = 0;
+	budgetBytes = 0;
+	numSlots = 0;
+	numUsedSlots = 0;
+	slots = nullptr;
+	numHits = 0;
+	numMisses = 0;
+}
+
+/*
+===========================
+rvmMegaTileCache::~rvmMegaTileCache
+===========================
+*/
+rvmMegaTileCache::~rvmMegaTileCache() {
+	Resize(0);
+}
+
+/*
+===========================
+rvmMegaTileCache::Init
+===========================
+*/
+void rvmMegaTileCache::Init(int tileBytes) {
+	idScopedCriticalSection lock(cacheLock);
+
+	this->tileBytes = tileBytes;
+	Resize((int64)idMegaTexture::r_megaTextureCacheSize.GetInteger() * 1024 * 1024);
+}
+
+/*
+===========================
+rvmMegaTileCache::Clear
+===========================
+*/
+void rvmMegaTileCache::Clear(void) {
+	idScopedCriticalSection lock(cacheLock);
+
+	for (int i = 0; i < numSlots; i++) {
+		slots[i].tileNum = -1;
+		slots[i].lruNode.Remove();
+	}
+	slotHash.Clear();
+	numUsedSlots = 0;
+}
+
+/*
+===========================
+rvmMegaTileCache::Resize
+
+All the slots are tile sized, so the budget just turns into a slot count, capped so the single
+allocation stays under 2 GB. Caller holds the lock.
+===========================
+*/
+void rvmMegaTileCache::Resize(int64 budgetBytes) {
+	if (slots != nullptr) {
+		for (int i = 0; i < numSlots; i++) {
+			slots[i].lruNode.Remove();
+		}
+		Mem_Free(slots[0].data);
+		delete[] slots;
+		slots = nullptr;
+	}
+
+	slotHash.Clear();
+	this->budgetBytes = budgetBytes;
+	numSlots = (tileBytes > 0) ? (int)Min(budgetBytes / tileBytes, (int64)(INT_MAX / tileBytes)) : 0;
+	numUsedSlots = 0;
+
+	if (numSlots <= 0) {
+		numSlots = 0;
+		return;
+	}
+
+	// one allocation for all the tile data, the slots just point into it.
+	byte *data = (byte *)Mem_Alloc(numSlots * tileBytes);
+
+	slots = new cacheSlot_t[numSlots];
+	for (int i = 0; i < numSlots; i++) {
+		slots[i].tileNum = -1;
+		slots[i].data = data + i * tileBytes;
+		slots[i].lruNode.SetOwner(&slots[i]);
+	}
+}
+
+/*
+===========================
+rvmMegaTileCache::FindSlot
+===========================
+*/
+int rvmMegaTileCache::FindSlot(int tileNum) const {
+	for (int i = slotHash.First(tileNum); i != -1; i = slotHash.Next(i)) {
+		if (slots[i].tileNum == tileNum) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+===========================
+rvmMegaTileCache::Lookup
+===========================
+*/
+bool rvmMegaTileCache::Lookup(int tileNum, byte *tileBuffer) {
+	idScopedCriticalSection lock(cacheLock);
+
+	// pick up budget changes made from the console
+	int64 budget = (int64)idMegaTexture::r_megaTextureCacheSize.GetInteger() * 1024 * 1024;
+	if (budget != budgetBytes) {
+		Resize(budget);
+	}
+
+	int slot = FindSlot(tileNum);
+	if (slot == -1) {
+		numMisses++;
+		return false;
+	}
+
+	numHits++;
+	slots[slot].lruNode.AddToFront(lruList);
+	memcpy(tileBuffer, slots[slot].data, tileBytes);
+	return true;
+}
+
+/*
+===========================
+rvmMegaTileCache::Contains
+
+Doesn't touch the hit/miss counts or the LRU order, used for prefetching.
+===========================
+*/
+bool rvmMegaTileCache::Contains(int tileNum) {
+	idScopedCriticalSection lock(cacheLock);
+
+	return FindSlot(tileNum) != -1;
+}
+
+/*
+===========================
+rvmMegaTileCache::Insert
+===========================
+*/
+void rvmMegaTileCache::Insert(int tileNum, const byte *tileData) {
+	idScopedCriticalSection lock(cacheLock);
+
+	if (numSlots == 0 || FindSlot(tileNum) != -1) {
+		return;
+	}
+
+	// use a free slot while we have them, after that recycle the least recently used one.
+	int slot;
+	if (numUsedSlots < numSlots) {
+		slot = numUsedSlots++;
+	}
+	else {
+		cacheSlot_t *oldest = lruList.Prev();
+		slot = oldest - slots;
+		slotHash.Remove(oldest->tileNum, slot);
+	}
+
+	slots[slot].tileNum = tileNum;
+	memcpy(slots[slot].data, tileData, tileBytes);
+	slots[slot].lruNode.AddToFront(lruList);
+	slotHash.Add(tileNum, slot);
+}
@@ -0,0 +1,736 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include <thread>
+
+#include "tr_local.h"
+#include "DXT/DXTCodec.h"
+#include "Color/ColorSpace.h"
+#include "../libs/zlib/zlib.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define MEGA_COMPOSE_SSE2
+#include <emmintrin.h>
+#endif
+
+idCVar idMegaTexture::r_megaTextureBuildThreads("r_megaTextureBuildThreads", "0", CVAR_RENDERER | CVAR_INTEGER, "threads encoding tiles while building megatextures, 0 uses every core");
+
+static const int MAX_ENCODE_THREADS = 64;
+
+/*
+===========================
+R_ComposeMegaTile_Generic
+
+Lights a tile of albedo texels with the lightmap, ambient added to the light first, and writes
+it out in tile order. Every 2x2 quad of it is averaged into mip as it goes by, mip may be null.
+===========================
+*/
+static void R_ComposeMegaTile_Generic(const byte *albedo, const byte *lit, int rowWidth, int ambient, byte *tile, int tileSize, byte *mip, int mipWidth) {
+	for (int y = 0; y < tileSize; y += 2) {
+		for (int x = 0; x < tileSize; x += 2) {
+			int sum[4] = { 0, 0, 0, 0 };
+
+			for (int yy = 0; yy < 2; yy++) {
+				for (int xx = 0; xx < 2; xx++) {
+					const byte	*a = albedo + ((y + yy) * rowWidth + x + xx) * 4;
+					const byte	*l = lit + ((y + yy) * rowWidth + x + xx) * 4;
+					byte		*t = tile + ((y + yy) * tileSize + x + xx) * 4;
+
+					for (int c = 0; c < 3; c++) {
+						t[c] = (byte)((a[c] * Min(l[c] + ambient, 255)) / 255);
+						sum[c] += t[c];
+					}
+					t[3] = 255;
+					sum[3] += 255;
+				}
+			}
+
+			if (mip != nullptr) {
+				byte *m = mip + ((y / 2) * mipWidth + x / 2) * 4;
+				m[0] = (sum[0] + 2) >> 2;
+				m[1] = (sum[1] + 2) >> 2;
+				m[2] = (sum[2] + 2) >> 2;
+				m[3] = (sum[3] + 2) >> 2;
+			}
+		}
+	}
+}
+
+#ifdef MEGA_COMPOSE_SSE2
+
+/*
+===========================
+R_ComposeTexels_SSE2
+
+Four texels of a * min(l + ambient, 255) / 255 as 16 bit channels, the divide is the exact
+(t + 1 + (t >> 8)) >> 8 for anything up to 255 * 255.
+===========================
+*/
+static inline void R_ComposeTexels_SSE2(const byte *albedo, const byte *lit, __m128i ambient, __m128i opaque, __m128i &lo, __m128i &hi) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+
+	__m128i a = _mm_loadu_si128((const __m128i *)albedo);
+	__m128i l = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)lit), ambient);
+
+	__m128i tLo = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(l, zero));
+	__m128i tHi = _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(l, zero));
+
+	tLo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(tLo, one), _mm_srli_epi16(tLo, 8)), 8);
+	tHi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(tHi, one), _mm_srli_epi16(tHi, 8)), 8);
+
+	// alpha is always opaque
+	lo = _mm_or_si128(_mm_andnot_si128(opaque, tLo), _mm_and_si128(opaque, _mm_set1_epi16(255)));
+	hi = _mm_or_si128(_mm_andnot_si128(opaque, tHi), _mm_and_si128(opaque, _mm_set1_epi16(255)));
+}
+
+/*
+===========================
+R_ComposeMegaTile_SSE2
+
+Same as the generic version four texels across two rows at a time, the two rows give the 2x2
+quads for the mip.
+===========================
+*/
+static void R_ComposeMegaTile_SSE2(const byte *albedo, const byte *lit, int rowWidth, int ambient, byte *tile, int tileSize, byte *mip, int mipWidth) {
+	const __m128i ambient8 = _mm_set1_epi8((char)ambient);
+	const __m128i opaque = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+	const __m128i two = _mm_set1_epi16(2);
+
+	for (int y = 0; y < tileSize; y += 2) {
+		for (int x = 0; x < tileSize; x += 4) {
+			__m128i topLo, topHi, bottomLo, bottomHi;
+
+			R_ComposeTexels_SSE2(albedo + (y * rowWidth + x) * 4, lit + (y * rowWidth + x) * 4, ambient8, opaque, topLo, topHi);
+			R_ComposeTexels_SSE2(albedo + ((y + 1) * rowWidth + x) * 4, lit + ((y + 1) * rowWidth + x) * 4, ambient8, opaque, bottomLo, bottomHi);
+
+			_mm_storeu_si128((__m128i *)(tile + (y * tileSize + x) * 4), _mm_packus_epi16(topLo, topHi));
+			_mm_storeu_si128((__m128i *)(tile + ((y + 1) * tileSize + x) * 4), _mm_packus_epi16(bottomLo, bottomHi));
+
+			if (mip != nullptr) {
+				__m128i left = _mm_add_epi16(topLo, bottomLo);		// texels 0 and 1
+				__m128i right = _mm_add_epi16(topHi, bottomHi);		// texels 2 and 3
+
+				left = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+				right = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+
+				__m128i quads = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(left, right), two), 2);
+				_mm_storel_epi64((__m128i *)(mip + ((y / 2) * mipWidth + x / 2) * 4), _mm_packus_epi16(quads, quads));
+			}
+		}
+	}
+}
+
+#endif
+
+/*
+===========================
+R_ComposeMegaTile
+===========================
+*/
+static void R_ComposeMegaTile(const byte *albedo, const byte *lit, int rowWidth, int ambient, byte *tile, int tileSize, byte *mip, int mipWidth) {
+#ifdef MEGA_COMPOSE_SSE2
+	R_ComposeMegaTile_SSE2(albedo, lit, rowWidth, ambient, tile, tileSize, mip, mipWidth);
+#else
+	R_ComposeMegaTile_Generic(albedo, lit, rowWidth, ambient, tile, tileSize, mip, mipWidth);
+#endif
+}
+
+/*
+===========================
+rvmMegaTileEncodeWorker::rvmMegaTileEncodeWorker
+===========================
+*/
+rvmMegaTileEncodeWorker::rvmMegaTileEncodeWorker(rvmMegaTileEncoder *encoder, int tileSize) {
+	this->encoder = encoder;
+	scratch = (byte *)R_StaticAlloc(tileSize * tileSize * 4 * 2);
+}
+
+/*
+===========================
+rvmMegaTileEncodeWorker::~rvmMegaTileEncodeWorker
+===========================
+*/
+rvmMegaTileEncodeWorker::~rvmMegaTileEncodeWorker() {
+	StopThread(true);
+	R_StaticFree(scratch);
+}
+
+/*
+===========================
+rvmMegaTileEncodeWorker::Run
+===========================
+*/
+int rvmMegaTileEncodeWorker::Run(void) {
+	while (encoder->EncodeNextTile(scratch)) {
+	}
+	return 0;
+}
+
+/*
+===========================
+rvmMegaTileEncoder::rvmMegaTileEncoder
+===========================
+*/
+rvmMegaTileEncoder::rvmMegaTileEncoder() {
+	memset(&header, 0, sizeof(header));
+	memset(&level, 0, sizeof(level));
+	writer = nullptr;
+	rows = nullptr;
+	rowWidth = 0;
+	lit = nullptr;
+	ambient = 0;
+	mipRows = nullptr;
+	mipWidth = 0;
+	childTiles = nullptr;
+	childTilesWide = 0;
+	childRows = 0;
+	rawTiles = nullptr;
+	deflatedEntries = nullptr;
+	deflatedOffset = 0;
+	deflateBound = 0;
+	tileRow = -1;
+	rowTiles = 0;
+	nextTile = 0;
+	encodedRow = nullptr;
+	scratch = nullptr;
+}
+
+/*
+===========================
+rvmMegaTileEncoder::~rvmMegaTileEncoder
+===========================
+*/
+rvmMegaTileEncoder::~rvmMegaTileEncoder() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaTileEncoder::Init
+===========================
+*/
+void rvmMegaTileEncoder::Init(const megaTextureHeader_t &header, int numThreads, rvmMegaBakeWriter *writer) {
+	Shutdown();
+
+	this->header = header;
+	this->writer = writer;
+
+	if (numThreads <= 0) {
+		numThreads = (int)std::thread::hardware_concurrency();
+	}
+	numThreads = idMath::ClampInt(1, MAX_ENCODE_THREADS, numThreads);
+
+	int tileBytes = header.tileSize * header.tileSize;
+
+	scratch = (byte *)R_StaticAlloc(tileBytes * 4 * 2);
+	deflateBound = GetDeflateBound(header.tileSize);
+
+	// the build thread encodes too, once it is done reading the next row
+	for (int i = 1; i < numThreads; i++) {
+		rvmMegaTileEncodeWorker *worker = new rvmMegaTileEncodeWorker(this, header.tileSize);
+		worker->StartWorkerThread(va("MegaTileEncoder%d", i), CORE_ANY, THREAD_NORMAL);
+		workers.Append(worker);
+	}
+}
+
+/*
+===========================
+rvmMegaTileEncoder::Shutdown
+===========================
+*/
+void rvmMegaTileEncoder::Shutdown(void) {
+	workers.DeleteContents(true);
+
+	if (scratch != nullptr) {
+		R_StaticFree(scratch);
+		scratch = nullptr;
+	}
+
+	rows = nullptr;
+	childTiles = nullptr;
+	rawTiles = nullptr;
+	deflatedEntries = nullptr;
+	tileRow = -1;
+}
+
+/*
+===========================
+rvmMegaTileEncoder::StartRow
+
+The row is encoded straight into a buffer of the writer, which may have to wait for the disk
+to give one back.
+===========================
+*/
+void rvmMegaTileEncoder::StartRow(void) {
+	encodedRow = writer->BeginWrite();
+	nextTile = 0;
+
+	for (int i = 0; i < workers.Num(); i++) {
+		workers[i]->SignalWork();
+	}
+}
+
+/*
+===========================
+rvmMegaTileEncoder::EncodeRow
+===========================
+*/
+void rvmMegaTileEncoder::EncodeRow(const megaBuildLevel_t &level, const byte *rows, int rowWidth, int tileRow) {
+	assert(this->tileRow == -1);
+	assert(level.tilesWide <= header.tilesWide);
+
+	this->level = level;
+	this->rows = rows;
+	this->rowWidth = rowWidth;
+	this->lit = nullptr;
+	this->childTiles = nullptr;
+	this->rawTiles = nullptr;
+	this->tileRow = tileRow;
+	this->rowTiles = level.tilesWide;
+	StartRow();
+}
+
+/*
+===========================
+rvmMegaTileEncoder::EncodeBaseRow
+===========================
+*/
+void rvmMegaTileEncoder::EncodeBaseRow(const megaBuildLevel_t &level, const byte *albedo, const byte *lit, int rowWidth, int ambient, byte *mipRows, int mipWidth, int tileRow) {
+	assert(this->tileRow == -1);
+	assert(level.tilesWide <= header.tilesWide);
+
+	this->level = level;
+	this->rows = albedo;
+	this->rowWidth = rowWidth;
+	this->lit = lit;
+	this->ambient = idMath::ClampInt(0, 255, ambient);
+	this->mipRows = mipRows;
+	this->mipWidth = mipWidth;
+	this->childTiles = nullptr;
+	this->rawTiles = nullptr;
+	this->tileRow = tileRow;
+	this->rowTiles = level.tilesWide;
+	StartRow();
+}
+
+/*
+===========================
+rvmMegaTileEncoder::EncodeMipRow
+===========================
+*/
+void rvmMegaTileEncoder::EncodeMipRow(const megaBuildLevel_t &level, const byte *childTiles, int childTilesWide, int childRows, int tileRow) {
+	assert(this->tileRow == -1);
+	assert(childTilesWide <= header.tilesWide);
+
+	this->level = level;
+	this->childTiles = childTiles;
+	this->childTilesWide = childTilesWide;
+	this->childRows = childRows;
+	this->rows = nullptr;
+	this->lit = nullptr;
+	this->rawTiles = nullptr;
+	this->tileRow = tileRow;
+	this->rowTiles = level.tilesWide;
+	StartRow();
+}
+
+/*
+===========================
+rvmMegaTileEncoder::DeflateRow
+===========================
+*/
+void rvmMegaTileEncoder::DeflateRow(const byte *tiles, int numTiles, megaTileTableEntry_t *entries, int64 fileOffset) {
+	assert(this->tileRow == -1);
+
+	this->rawTiles = tiles;
+	this->deflatedEntries = entries;
+	this->deflatedOffset = fileOffset;
+	this->rows = nullptr;
+	this->lit = nullptr;
+	this->childTiles = nullptr;
+	this->tileRow = 0;
+	this->rowTiles = numTiles;
+	StartRow();
+}
+
+/*
+===========================
+rvmMegaTileEncoder::GetDeflateBound
+
+The most a tile can take up in the writer's buffer while it is being deflated.
+===========================
+*/
+int rvmMegaTileEncoder::GetDeflateBound(int tileSize) {
+	return (int)compressBound(tileSize * tileSize);
+}
+
+/*
+===========================
+rvmMegaTileEncoder::FilterChildTiles
+
+Decodes the four children of a tile back to RGB and box filters each into its quarter of the
+tile, a child off the edge of the level below leaves its quarter black.
+===========================
+*/
+void rvmMegaTileEncoder::FilterChildTiles(int rowBlock, byte *tileRGBA, byte *childRGBA) const {
+	int	tileSize = header.tileSize;
+	int	halfSize = tileSize / 2;
+
+	for (int yy = 0; yy < 2; yy++) {
+		for (int xx = 0; xx < 2; xx++) {
+			int		tx = rowBlock * 2 + xx;
+			byte	*quarter = tileRGBA + (yy * halfSize * tileSize + xx * halfSize) * 4;
+
+			if (tx >= childTilesWide || yy >= childRows) {
+				for (int y = 0; y < halfSize; y++) {
+					memset(quarter + y * tileSize * 4, 0, halfSize * 4);
+				}
+				continue;
+			}
+
+			idDxtDecoder decoder;
+			decoder.DecompressYCoCgDXT5(childTiles + (yy * childTilesWide + tx) * tileSize * tileSize, childRGBA, tileSize, tileSize);
+			idColorSpace::ConvertCoCg_YToRGB(childRGBA, childRGBA, tileSize, tileSize);
+
+			for (int y = 0; y < halfSize; y++) {
+				const byte	*in = childRGBA + y * 2 * tileSize * 4;
+				byte		*out = quarter + y * tileSize * 4;
+
+				for (int x = 0; x < halfSize; x++, in += 8, out += 4) {
+					out[0] = (in[0] + in[4] + in[0 + tileSize * 4] + in[4 + tileSize * 4] + 2) >> 2;
+					out[1] = (in[1] + in[5] + in[1 + tileSize * 4] + in[5 + tileSize * 4] + 2) >> 2;
+					out[2] = (in[2] + in[6] + in[2 + tileSize * 4] + in[6 + tileSize * 4] + 2) >> 2;
+					out[3] = (in[3] + in[7] + in[3 + tileSize * 4] + in[7 + tileSize * 4] + 2) >> 2;
+				}
+			}
+		}
+	}
+}
+
+/*
+===========================
+rvmMegaTileEncoder::DeflateTile
+
+Deflates a tile into its own slot of encodedRow, WriteRow packs the slots together after.
+===========================
+*/
+void rvmMegaTileEncoder::DeflateTile(int rowBlock) {
+	int			tileBytes = header.tileSize * header.tileSize;
+	const byte	*tile = rawTiles + rowBlock * tileBytes;
+	byte		*deflated = encodedRow + rowBlock * deflateBound;
+	uLongf		deflatedSize = deflateBound;
+
+	if (compress2(deflated, &deflatedSize, tile, tileBytes, Z_BEST_COMPRESSION) != Z_OK || (int)deflatedSize >= tileBytes) {
+		memcpy(deflated, tile, tileBytes);
+		deflatedSize = tileBytes;
+	}
+	deflatedEntries[rowBlock].size = (int)deflatedSize;
+}
+
+/*
+===========================
+rvmMegaTileEncoder::EncodeNextTile
+
+Each tile is composed, gathered out of the row or filtered from its children, converted to
+YCoCg and DXT5 encoded into its own slot in encodedRow. Nothing is shared between tiles but the
+counter, base tiles also filter into their own quarter of the mip row.
+===========================
+*/
+bool rvmMegaTileEncoder::EncodeNextTile(byte *scratch) {
+	int rowBlock;
+
+	tileLock.Lock();
+	rowBlock = nextTile;
+	if (rowBlock < rowTiles) {
+		nextTile++;
+	}
+	tileLock.Unlock();
+
+	if (rowBlock >= rowTiles) {
+		return false;
+	}
+
+	if (rawTiles != nullptr) {
+		DeflateTile(rowBlock);
+		return true;
+	}
+
+	int		tileSize = header.tileSize;
+	byte	*tileRGBA = scratch;
+	idDxtEncoder encoder;
+
+	if (childTiles != nullptr) {
+		FilterChildTiles(rowBlock, tileRGBA, scratch + tileSize * tileSize * 4);
+	}
+	else if (lit != nullptr) {
+		byte *mip = (mipRows != nullptr) ? mipRows + rowBlock * (tileSize / 2) * 4 : nullptr;
+		R_ComposeMegaTile(rows + rowBlock * tileSize * 4, lit + rowBlock * tileSize * 4, rowWidth, ambient, tileRGBA, tileSize, mip, mipWidth);
+	}
+	else {
+		for (int y = 0; y < tileSize; y++) {
+			memcpy(&tileRGBA[y * tileSize * 4], rows + (y * rowWidth + rowBlock * tileSize) * 4, tileSize * 4);
+		}
+	}
+
+	// convert the image data to YCoCg and use the YCoCgDXT5 compressor
+	idColorSpace::ConvertRGBToCoCg_Y(tileRGBA, tileRGBA, tileSize, tileSize);
+
+	encoder.CompressYCoCgDXT5Fast_Generic(tileRGBA, encodedRow + rowBlock * tileSize * tileSize, tileSize, tileSize);
+	return true;
+}
+
+/*
+===========================
+rvmMegaTileEncoder::WriteRow
+===========================
+*/
+void rvmMegaTileEncoder::WriteRow(void) {
+	if (tileRow == -1) {
+		return;
+	}
+
+	while (EncodeNextTile(scratch)) {
+	}
+	for (int i = 0; i < workers.Num(); i++) {
+		workers[i]->WaitForThread();
+	}
+
+	int tileBytes = header.tileSize * header.tileSize;
+
+	if (rawTiles != nullptr) {
+		// slide the deflated tiles down over the gaps so the row goes out in one write, a tile
+		// never moves past where it started so they can be done in order
+		int packed = 0;
+		for (int i = 0; i < rowTiles; i++) {
+			megaTileTableEntry_t &entry = deflatedEntries[i];
+
+			memmove(encodedRow + packed, encodedRow + i * deflateBound, entry.size);
+			entry.offset = deflatedOffset + packed;
+			packed += entry.size;
+		}
+		writer->AddSpan(deflatedOffset, 0, packed);
+	}
+	else {
+		for (int rowBlock = 0; rowBlock < level.tilesWide; rowBlock++) {
+			int tileNum = level.tileOffset + rvmMegaTextureFile::TileIndex(header.layout, level.tilesWide, level.tilesHigh, rowBlock, tileRow);
+			writer->AddSpan((int64)tileNum * tileBytes, rowBlock * tileBytes, tileBytes);
+		}
+	}
+	writer->EndWrite();
+	encodedRow = nullptr;
+
+	rawTiles = nullptr;
+	deflatedEntries = nullptr;
+	rows = nullptr;
+	lit = nullptr;
+	mipRows = nullptr;
+	childTiles = nullptr;
+	tileRow = -1;
+}
+
+/*
+===========================
+rvmMegaMipBuilder::rvmMegaMipBuilder
+===========================
+*/
+rvmMegaMipBuilder::rvmMegaMipBuilder() {
+	tileSize = 0;
+	encoder = nullptr;
+}
+
+/*
+===========================
+rvmMegaMipBuilder::~rvmMegaMipBuilder
+===========================
+*/
+rvmMegaMipBuilder::~rvmMegaMipBuilder() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaMipBuilder::Init
+
+Levels halve down to a single tile the same way GenerateMegaMipMaps always laid them out,
+anything off the edge of a level with an odd number of tiles stays zero.
+===========================
+*/
+void rvmMegaMipBuilder::Init(const megaTextureHeader_t &header, rvmMegaTileEncoder *encoder) {
+	Shutdown();
+
+	this->tileSize = header.tileSize;
+	this->encoder = encoder;
+
+	int	tileOffset = 1 + header.tilesWide * header.tilesHigh;
+	int	width = header.tilesWide;
+	int	height = header.tilesHigh;
+
+	while (width > 1 || height > 1) {
+		width = (width + 1) >> 1;
+		height = (height + 1) >> 1;
+
+		mipLevel_t &mip = levels.Alloc();
+		mip.level.tileOffset = tileOffset;
+		mip.level.tilesWide = width;
+		mip.level.tilesHigh = height;
+		mip.width = width * tileSize;
+		for (int i = 0; i < 2; i++) {
+			mip.rows[i] = (byte *)R_StaticAlloc(mip.width * tileSize * 4);
+			memset(mip.rows[i], 0, mip.width * tileSize * 4);
+		}
+		mip.current = 0;
+		mip.tileRow = 0;
+		mip.halvesFilled = 0;
+
+		tileOffset += width * height;
+	}
+}
+
+/*
+===========================
+rvmMegaMipBuilder::Shutdown
+===========================
+*/
+void rvmMegaMipBuilder::Shutdown(void) {
+	for (int i = 0; i < levels.Num(); i++) {
+		R_StaticFree(levels[i].rows[0]);
+		R_StaticFree(levels[i].rows[1]);
+	}
+	levels.Clear();
+	encoder = nullptr;
+}
+
+/*
+===========================
+rvmMegaMipBuilder::BeginBaseRow
+===========================
+*/
+byte *rvmMegaMipBuilder::BeginBaseRow(int &mipWidth) {
+	if (levels.Num() == 0) {
+		mipWidth = 0;
+		return nullptr;
+	}
+
+	mipLevel_t &mip = levels[0];
+	mipWidth = mip.width;
+	return mip.rows[mip.current] + mip.halvesFilled * (tileSize / 2) * mip.width * 4;
+}
+
+/*
+===========================
+rvmMegaMipBuilder::EndBaseRow
+===========================
+*/
+void rvmMegaMipBuilder::EndBaseRow(void) {
+	if (levels.Num() == 0) {
+		return;
+	}
+
+	mipLevel_t &mip = levels[0];
+	mip.halvesFilled++;
+	if (mip.halvesFilled == 2) {
+		EmitRow(0);
+	}
+}
+
+/*
+===========================
+rvmMegaMipBuilder::Finish
+===========================
+*/
+void rvmMegaMipBuilder::Finish(void) {
+	// going down the levels, so every row flushed here still reaches the levels below it
+	for (int i = 0; i < levels.Num(); i++) {
+		mipLevel_t &mip = levels[i];
+
+		if (mip.halvesFilled != 0) {
+			int halfBytes = mip.width * (tileSize / 2) * 4;
+			memset(mip.rows[mip.current] + halfBytes, 0, halfBytes);
+			EmitRow(i);
+		}
+	}
+}
+
+/*
+===========================
+rvmMegaMipBuilder::Downsample
+
+Box filters a row of tiles of the level above into the next half of this level's row. The
+rows being read may be getting encoded at the same time, that only reads them too.
+===========================
+*/
+void rvmMegaMipBuilder::Downsample(int levelNum, const byte *rows, int rowWidth) {
+	mipLevel_t	&mip = levels[levelNum];
+	int			halfSize = tileSize / 2;
+	byte *		dest = mip.rows[mip.current] + mip.halvesFilled * halfSize * mip.width * 4;
+
+	for (int y = 0; y < halfSize; y++) {
+		const byte *	in = rows + y * 2 * rowWidth * 4;
+		byte *			o = dest + y * mip.width * 4;
+
+		for (int x = 0; x < rowWidth / 2; x++, in += 8, o += 4) {
+			o[0] = (in[0] + in[4] + in[0 + rowWidth * 4] + in[4 + rowWidth * 4] + 2) >> 2;
+			o[1] = (in[1] + in[5] + in[1 + rowWidth * 4] + in[5 + rowWidth * 4] + 2) >> 2;
+			o[2] = (in[2] + in[6] + in[2 + rowWidth * 4] + in[6 + rowWidth * 4] + 2) >> 2;
+			o[3] = (in[3] + in[7] + in[3 + rowWidth * 4] + in[7 + rowWidth * 4] + 2) >> 2;
+		}
+	}
+
+	mip.halvesFilled++;
+	if (mip.halvesFilled == 2) {
+		EmitRow(levelNum);
+	}
+}
+
+/*
+===========================
+rvmMegaMipBuilder::EmitRow
+===========================
+*/
+void rvmMegaMipBuilder::EmitRow(int levelNum) {
+	mipLevel_t	&mip = levels[levelNum];
+	const byte	*rows = mip.rows[mip.current];
+
+	encoder->WriteRow();
+	encoder->EncodeRow(mip.level, rows, mip.width, mip.tileRow);
+
+	mip.current ^= 1;
+	mip.tileRow++;
+	mip.halvesFilled = 0;
+
+	if (levelNum + 1 < levels.Num()) {
+		Downsample(levelNum + 1, rows, mip.width);
+	}
+}
@@ -32,21 +32,11 @@ If you have questions concerning this license or the applicable additional terms
 
 #include "tr_local.h"
 
-static union {
-	int		intVal;
-	byte	color[4];
-} fillColor;
-
-static byte	colors[8][4] = {
-	{ 0, 0, 0, 255 },
-	{ 255, 0, 0, 255 },
-	{ 0, 255, 0, 255 },
-	{ 255, 255, 0, 255 },
-	{ 0, 0, 255, 255 },
-	{ 255, 0, 255, 255 },
-	{ 0, 255, 255, 255 },
-	{ 255, 255, 255, 255 }
-};
+#include "../libs/zlib/zlib.h"
+
+#include <limits.h>
+
+idList<rvmMegaTextureFile *> rvmMegaTextureFile::loadedFiles;
 
 /*
 ===========================
@@ -55,8 +45,14 @@ rvmMegaTextureFile::rvmMegaTextureFile
 */
 rvmMegaTextureFile::rvmMegaTextureFile()
 {
-	fileHandle = nullptr;
+	streamer = nullptr;
 	numLevels = 0;
+	tileSize = 0;
+	tileBytes = 0;
+	tilesPerLevel = 0;
+	levelWidth = 0;
+	offMapTile = nullptr;
+	memset(&stats, 0, sizeof(stats));
 }
 
 /*
@@ -65,10 +61,27 @@ rvmMegaTextureFile::~rvmMegaTextureFile
 ===========================
 */
 rvmMegaTextureFile::~rvmMegaTextureFile() {
-	if (fileHandle != nullptr) {
-		fileSystem->CloseFile(fileHandle);
-		fileHandle = nullptr;
+	// the streaming thread reads from the file, so it has to go first.
+	if (streamer != nullptr) {
+		delete streamer;
+		streamer = nullptr;
+	}
+
+	for (int i = 0; i < pendingUploads.Num(); i++) {
+		if (pendingUploads[i].buffer != nullptr) {
+			stagingPool.Free(pendingUploads[i].buffer);
+		}
 	}
+	pendingUploads.Clear();
+
+	if (offMapTile != nullptr) {
+		Mem_Free(offMapTile);
+		offMapTile = nullptr;
+	}
+
+	reader.Close();
+
+	loadedFiles.Remove(this);
 }
 
 /*
@@ -80,79 +93,537 @@ rvmMegaTextureFile *rvmMegaTextureFile::LoadMegaTextureFile(const char *name) {
 	int		width, height;
 	rvmMegaTextureFile *megaTextureFile = new rvmMegaTextureFile();
 		
-	megaTextureFile->fileHandle = fileSystem->OpenFileRead(name);
-	if (!megaTextureFile->fileHandle) {
+	megaTextureFile->name = name;
+
+	if (!megaTextureFile->reader.Open(name)) {
 		common->Printf("rvmMegaTextureFile: failed to open %s\n", name);
 		delete megaTextureFile;
 		return nullptr;
 	}
 
-	megaTextureFile->fileHandle->Read(&megaTextureFile->header, sizeof(megaTextureFile->header));
-	if (megaTextureFile->header.tileSize < 64 || megaTextureFile->header.tilesWide < 1 || megaTextureFile->header.tilesHigh < 1) {
+	byte headerData[sizeof(megaTextureHeader_t)];
+	if (!megaTextureFile->reader.ReadAt(headerData, 0, sizeof(headerData)) || !ParseHeader(headerData, sizeof(headerData), megaTextureFile->header)) {
 		common->Printf("idMegaTexture: bad header on %s\n", name);
 		delete megaTextureFile;
 		return nullptr;
 	}
 
-	megaTextureFile->numLevels = 0;
-	width = megaTextureFile->header.tilesWide;
-	height = megaTextureFile->header.tilesHigh;
+	if (megaTextureFile->header.compression == MEGA_COMPRESSION_ZLIB && !ReadTileTable(megaTextureFile->reader, megaTextureFile->header, megaTextureFile->tileTable)) {
+		common->Printf("idMegaTexture: bad tile table on %s\n", name);
+		delete megaTextureFile;
+		return nullptr;
+	}
+
+	// size everything off the tile size in the file, and fit as many tiles in a level image as the hardware lets us.
+	// without a renderer running (megaBench on a headless box) there is no hardware limit to respect
+	int maxTextureSize = (glConfig.maxTextureSize > 0) ? glConfig.maxTextureSize : MAX_TILE_PER_LEVEL * MAX_TILE_SIZE;
+
+	int tileSize = megaTextureFile->header.tileSize;
+	if (!idMath::IsPowerOfTwo(tileSize) || tileSize < MIN_TILE_SIZE || tileSize > MAX_TILE_SIZE || tileSize * 2 > maxTextureSize) {
+		common->Printf("idMegaTexture: unsupported tile size %d on %s\n", tileSize, name);
+		delete megaTextureFile;
+		return nullptr;
+	}
+
+	int maxLevelWidth = Min(idMegaTexture::r_megaTextureLevelSize.GetInteger(), maxTextureSize);
+	int tilesPerLevel = 2;
+	while (tilesPerLevel * 2 * tileSize <= maxLevelWidth && tilesPerLevel * 2 <= MAX_TILE_PER_LEVEL) {
+		tilesPerLevel *= 2;
+	}
+
+	megaTextureFile->tileSize = tileSize;
+	megaTextureFile->tileBytes = tileSize * tileSize;
+	megaTextureFile->tilesPerLevel = tilesPerLevel;
+	megaTextureFile->levelWidth = tilesPerLevel * tileSize;
+	megaTextureFile->offMapTile = (byte *)Mem_ClearedAlloc(megaTextureFile->tileBytes);
 
-	int	tileOffset = 1;					// just past the header
+	megaTextureFile->numLevels = 0;
 
 	memset(megaTextureFile->levels, 0, sizeof(levels));
-	while (1) {
+	for (int i = 0; i < megaTextureFile->header.numLevels; i++) {
+		const megaLevelDesc_t &desc = megaTextureFile->header.levels[i];
 		idTextureLevel *level = &megaTextureFile->levels[megaTextureFile->numLevels];
 
+		width = desc.tilesWide;
+		height = desc.tilesHigh;
+
 		level->mega = megaTextureFile;
-		level->tileOffset = tileOffset;
+		level->tileOffset = desc.firstTile;
 		level->tilesWide = width;
 		level->tilesHigh = height;
+		level->tileSize = tileSize;
+		level->tilesPerLevel = tilesPerLevel;
 		level->parms[0] = -1;		// initially mask everything
 		level->parms[1] = 0;
 		level->parms[2] = 0;
-		level->parms[3] = (float)width / (float)TILE_PER_LEVEL;
+		level->parms[3] = (float)width / (float)tilesPerLevel;
 		level->Invalidate();
 
-		tileOffset += level->tilesWide * level->tilesHigh;
+		megaTextureFile->numLevels++;
+
+		if (width <= tilesPerLevel && height <= tilesPerLevel) {
+			break;
+		}
+		if (megaTextureFile->numLevels == MAX_LEVELS) {
+			common->Warning("idMegaTexture: %s has more than %d levels, dropping the coarsest\n", name, MAX_LEVELS);
+			break;
+		}
+	}
+
+	// reading a compressed tile borrows a staging buffer, so the pool has to be up before the preload
+	megaTextureFile->tileCache.Init(megaTextureFile->tileBytes);
+	megaTextureFile->stagingPool.Init(megaTextureFile->tileBytes, idMegaTexture::r_megaTextureStagingBuffers.GetInteger());
+
+	if (!megaTextureFile->PreloadPinnedLevels()) {
+		common->Printf("idMegaTexture: failed to read the coarse levels of %s\n", name);
+		delete megaTextureFile;
+		return nullptr;
+	}
+
+	common->Printf("%s: %d x %d tiles of %d, %d tiles per level\n", name, megaTextureFile->header.tilesWide, megaTextureFile->header.tilesHigh, tileSize, tilesPerLevel);
+
+	megaTextureFile->streamer = new rvmMegaTextureStreamer(megaTextureFile);
+	megaTextureFile->streamer->Start();
+
+	loadedFiles.Append(megaTextureFile);
+
+	return megaTextureFile;
+}
+
+/*
+===========================
+rvmMegaTextureFile::PreloadPinnedLevels
+
+The levels that fit entirely in the window never move, so there is no reason to stream them. They
+are the last levels in the file, which makes their tiles one contiguous run that can be read with a
+single read and uploaded before the first frame. Once up they are resident for good, and show
+through wherever the finer levels are still streaming.
+===========================
+*/
+bool rvmMegaTextureFile::PreloadPinnedLevels(void) {
+	int		firstLevel = numLevels;
+
+	while (firstLevel > 0 && levels[firstLevel - 1].tilesWide <= tilesPerLevel && levels[firstLevel - 1].tilesHigh <= tilesPerLevel) {
+		firstLevel--;
+	}
+	if (firstLevel == numLevels) {
+		return true;
+	}
+
+	const idTextureLevel &lastLevel = levels[numLevels - 1];
+	int		firstTile = levels[firstLevel].tileOffset;
+	int		numTiles = lastLevel.tileOffset + lastLevel.tilesWide * lastLevel.tilesHigh - firstTile;
+	int64	offset = (int64)firstTile * tileBytes;
+	int64	length = (int64)numTiles * tileBytes;
+	bool	contiguous = true;
 
-		char	str[1024];
-		sprintf(str, "_mega_%i", megaTextureFile->numLevels);
+	if (header.compression == MEGA_COMPRESSION_ZLIB) {
+		if (firstTile + numTiles > tileTable.Num()) {
+			return false;
+		}
 
-		// give each level a default fill color
-		for (int i = 0; i < 4; i++) {
-			fillColor.color[i] = colors[megaTextureFile->numLevels + 1][i];
+		// the compressor writes the tiles in order, but only lean on that if the table agrees
+		offset = tileTable[firstTile].offset;
+		for (int i = firstTile + 1; i < firstTile + numTiles; i++) {
+			if (tileTable[i].offset != tileTable[i - 1].offset + tileTable[i - 1].size) {
+				contiguous = false;
+				break;
+			}
 		}
+		length = tileTable[firstTile + numTiles - 1].offset + tileTable[firstTile + numTiles - 1].size - offset;
+	}
 
-		idImageOpts opts;
-		opts.format = FMT_DXT5;
-		opts.colorFormat = CFM_DEFAULT;
-		opts.gammaMips = 0;
-		opts.width = MAX_LEVEL_WIDTH;
-		opts.height = MAX_LEVEL_WIDTH;
-		opts.textureType = TT_2D;
-		opts.isPersistant = true;
-		opts.numMSAASamples = 0;
-		opts.numLevels = 1;
+	// the pinned levels are a window's worth of tiles, but don't trust a damaged table with that
+	if (length > INT_MAX) {
+		contiguous = false;
+	}
 
-		idTempArray<byte> data(MAX_LEVEL_WIDTH * MAX_LEVEL_WIDTH * 4);
+	byte *	data = nullptr;
+	byte *	tileBuffer = (byte *)Mem_Alloc(tileBytes);
 
-		for (int i = 0; i < MAX_LEVEL_WIDTH * MAX_LEVEL_WIDTH; i++) {
-			((int *)data.Ptr())[i] = fillColor.intVal;
+	if (contiguous) {
+		data = (byte *)Mem_Alloc((int)length);
+		if (!reader.ReadAt(data, offset, (int)length)) {
+			Mem_Free(data);
+			Mem_Free(tileBuffer);
+			return false;
 		}
+	}
 
-		megaTextureFile->levels[megaTextureFile->numLevels].image = globalImages->ScratchImage(str, &opts, TF_LINEAR, TR_REPEAT, TD_DIFFUSE);
-		megaTextureFile->levels[megaTextureFile->numLevels].image->UploadScratch(data.Ptr(), MAX_LEVEL_WIDTH, MAX_LEVEL_WIDTH);
-		megaTextureFile->numLevels++;
+	GetUploadBackend()->BeginBatch();
+
+	for (int i = firstLevel; i < numLevels; i++) {
+		idTextureLevel *level = &levels[i];
+
+		for (int y = 0; y < tilesPerLevel; y++) {
+			for (int x = 0; x < tilesPerLevel; x++) {
+				idTextureTile *tile = &level->tileMap[x][y];
+				const byte *tileData = offMapTile;
+
+				if (x < level->tilesWide && y < level->tilesHigh) {
+					int tileNum = GetTileNum(*level, x, y);
+
+					if (!contiguous) {
+						tileData = ReadTile(tileBuffer, tileNum);
+					}
+					else if (header.compression != MEGA_COMPRESSION_ZLIB) {
+						tileData = data + (tileNum - firstTile) * tileBytes;
+					}
+					else {
+						const megaTileTableEntry_t &entry = tileTable[tileNum];
+						const byte *stored = data + entry.offset - offset;
+
+						tileData = tileBuffer;
+						if (entry.size == tileBytes) {
+							tileData = stored;
+						}
+						else if (!DecompressTile(stored, entry.size, tileBuffer, tileBytes)) {
+							common->Warning("rvmMegaTextureFile::PreloadPinnedLevels: failed to decompress tile %d\n", tileNum);
+							memset(tileBuffer, 0, tileBytes);
+						}
+					}
+				}
+
+				tile->requestedX = x;
+				tile->requestedY = y;
+				level->UploadTile(x, y, x, y, tileData);
+			}
+		}
+
+		level->windowCorner[0] = 0;
+		level->windowCorner[1] = 0;
+		level->SetUnmaskedParms();
+		level->pinned = true;
+		level->resident = true;
+	}
+
+	GetUploadBackend()->EndBatch();
+
+	if (data != nullptr) {
+		Mem_Free(data);
+	}
+	Mem_Free(tileBuffer);
+
+	return true;
+}
+
+/*
+========================
+rvmMegaTextureFile::ParseHeader
+========================
+*/
+bool rvmMegaTextureFile::ParseHeader(const byte *data, int length, megaTextureHeader_t &header) {
+	const int *fields = (const int *)data;
+
+	if (length < 3 * (int)sizeof(int)) {
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+
+	if (fields[0] == MEGA_FILE_MAGIC) {
+		int version = fields[1];
+		if (version < 2 || version > MEGA_FILE_VERSION) {
+			common->Warning("idMegaTexture: unknown version %d\n", version);
+			return false;
+		}
+
+		header.layout = MEGA_LAYOUT_LINEAR;
+
+		int headerLength;
+		if (version == 2) {
+			headerLength = offsetof(megaTextureHeader_t, layout);
+		}
+		else if (version == 3) {
+			headerLength = offsetof(megaTextureHeader_t, numLevels);
+		}
+		else {
+			headerLength = sizeof(megaTextureHeader_t);
+		}
+		if (length < headerLength) {
+			return false;
+		}
+		memcpy(&header, data, headerLength);
+
+		if (header.layout != MEGA_LAYOUT_LINEAR && header.layout != MEGA_LAYOUT_MORTON) {
+			return false;
+		}
+		if (header.compression != MEGA_COMPRESSION_NONE && header.compression != MEGA_COMPRESSION_ZLIB) {
+			return false;
+		}
+		if (header.compression == MEGA_COMPRESSION_ZLIB && header.numTiles < 1) {
+			return false;
+		}
+	}
+	else {
+		// version 1, just the tile counts
+		header.magic = MEGA_FILE_MAGIC;
+		header.version = 1;
+		header.tileSize = fields[0];
+		header.tilesWide = fields[1];
+		header.tilesHigh = fields[2];
+		header.compression = MEGA_COMPRESSION_NONE;
+		header.numTiles = 0;
+		header.layout = MEGA_LAYOUT_LINEAR;
+	}
+
+	if (header.tileSize < MIN_TILE_SIZE || header.tilesWide < 1 || header.tilesHigh < 1) {
+		return false;
+	}
+
+	// tile numbers are ints, leave room for the mips
+	if ((int64)header.tilesWide * header.tilesHigh > INT_MAX / 2) {
+		return false;
+	}
+
+	// everything that builds or reads a file walks the levels by halving, so a version 4 file
+	// has to agree with that
+	megaTextureHeader_t expected = header;
+	InitLevels(expected);
+
+	const megaLevelDesc_t &lastLevel = expected.levels[expected.numLevels - 1];
+	if (lastLevel.tilesWide != 1 || lastLevel.tilesHigh != 1) {
+		return false;
+	}
+
+	if (header.version < 4) {
+		// older compressed files only ever counted the tiles in the table
+		int numTiles = header.numTiles;
+		header = expected;
+		if (header.compression == MEGA_COMPRESSION_ZLIB) {
+			header.numTiles = numTiles;
+		}
+		return true;
+	}
+
+	if (header.numLevels != expected.numLevels || header.numTiles != expected.numTiles) {
+		return false;
+	}
+	for (int i = 0; i < header.numLevels; i++) {
+		const megaLevelDesc_t &level = header.levels[i];
+
+		if (level.tilesWide != expected.levels[i].tilesWide || level.tilesHigh != expected.levels[i].tilesHigh || level.firstTile != expected.levels[i].firstTile) {
+			return false;
+		}
+		if (header.compression == MEGA_COMPRESSION_NONE && level.offset != expected.levels[i].offset) {
+			return false;
+		}
+	}
+	return true;
+}
 
-		if (width <= TILE_PER_LEVEL && height <= TILE_PER_LEVEL) {
+/*
+===========================
+rvmMegaTextureFile::HeaderLength
+===========================
+*/
+int rvmMegaTextureFile::HeaderLength(const megaTextureHeader_t &header) {
+	if (header.version == 1) {
+		return 3 * sizeof(int);
+	}
+	if (header.version == 2) {
+		return offsetof(megaTextureHeader_t, layout);
+	}
+	if (header.version == 3) {
+		return offsetof(megaTextureHeader_t, numLevels);
+	}
+	return sizeof(megaTextureHeader_t);
+}
+
+/*
+===========================
+rvmMegaTextureFile::InitLevels
+
+A 128k texture of 128 pixel tiles is 1024 x 1024 tiles, over 4 GB with its mips, so the offsets
+are all worked out in 64 bits. Tile numbers stay ints, that's still 2 billion tiles.
+===========================
+*/
+void rvmMegaTextureFile::InitLevels(megaTextureHeader_t &header) {
+	int64	tileBytes = (int64)header.tileSize * header.tileSize;
+	int		width = header.tilesWide;
+	int		height = header.tilesHigh;
+	int		firstTile = 1;					// just past the header
+
+	memset(header.levels, 0, sizeof(header.levels));
+	header.numLevels = 0;
+
+	while (header.numLevels < MAX_MEGA_FILE_LEVELS) {
+		megaLevelDesc_t &level = header.levels[header.numLevels++];
+
+		level.tilesWide = width;
+		level.tilesHigh = height;
+		level.firstTile = firstTile;
+		level.offset = firstTile * tileBytes;
+
+		firstTile += width * height;
+
+		if (width == 1 && height == 1) {
 			break;
 		}
 		width = (width + 1) >> 1;
 		height = (height + 1) >> 1;
 	}
 
-	return megaTextureFile;
+	header.numTiles = firstTile;
+}
+
+/*
+===========================
+rvmMegaTextureFile::TileTableLength
+===========================
+*/
+int64 rvmMegaTextureFile::TileTableLength(const megaTextureHeader_t &header) {
+	int entrySize = (header.version < 4) ? sizeof(megaTileTableEntry32_t) : sizeof(megaTileTableEntry_t);
+	return (int64)header.numTiles * entrySize;
+}
+
+/*
+===========================
+rvmMegaTextureFile::ParseTileTable
+===========================
+*/
+bool rvmMegaTextureFile::ParseTileTable(const byte *data, const megaTextureHeader_t &header, int64 fileLength, idList<megaTileTableEntry_t> &tileTable) {
+	tileTable.SetNum(header.numTiles);
+
+	if (header.version >= 4) {
+		memcpy(tileTable.Ptr(), data, tileTable.Num() * sizeof(megaTileTableEntry_t));
+	}
+	else {
+		const megaTileTableEntry32_t *entries = (const megaTileTableEntry32_t *)data;
+
+		for (int i = 0; i < tileTable.Num(); i++) {
+			tileTable[i].offset = entries[i].offset;
+			tileTable[i].size = entries[i].size;
+			tileTable[i].pad = 0;
+		}
+	}
+
+	// everything that reads a tile sizes its buffers off the tile, so nothing past here has to check
+	int tileBytes = header.tileSize * header.tileSize;
+
+	for (int i = 1; i < tileTable.Num(); i++) {
+		const megaTileTableEntry_t &entry = tileTable[i];
+
+		if (entry.offset < 0 || entry.size <= 0 || entry.size > tileBytes || entry.offset + entry.size > fileLength) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+===========================
+rvmMegaTextureFile::ReadTileTable
+===========================
+*/
+bool rvmMegaTextureFile::ReadTileTable(rvmMegaTextureReader &reader, const megaTextureHeader_t &header, idList<megaTileTableEntry_t> &tileTable) {
+	int64 tableLength = TileTableLength(header);
+	if (tableLength > INT_MAX) {
+		return false;
+	}
+
+	byte *tableData = (byte *)Mem_Alloc((int)tableLength);
+
+	bool tableOk = reader.ReadAt(tableData, HeaderLength(header), (int)tableLength) && ParseTileTable(tableData, header, reader.Length(), tileTable);
+
+	Mem_Free(tableData);
+	return tableOk;
+}
+
+/*
+===========================
+rvmMegaTextureFile::SeekFile
+===========================
+*/
+void rvmMegaTextureFile::SeekFile(idFile *file, int64 offset) {
+	static const long MAX_SEEK_STEP = 1 << 30;
+
+	if ((long)offset == offset) {
+		file->Seek((long)offset, FS_SEEK_SET);
+		return;
+	}
+
+	file->Seek(0, FS_SEEK_SET);
+	while (offset > 0) {
+		long step = (long)Min(offset, (int64)MAX_SEEK_STEP);
+		file->Seek(step, FS_SEEK_CUR);
+		offset -= step;
+	}
+}
+
+/*
+===========================
+rvmMegaTextureFile::TileIndex
+
+Morton order interleaves the bits of x and y, so any aligned square of tiles is one run of the
+file and a window step only touches a handful of runs. Only power of two levels can be numbered
+densely that way: the low bits of both axes are interleaved and the extra high bits of the longer
+axis go on top. Anything else, and levels that are a single row or column, stay in row order.
+===========================
+*/
+int rvmMegaTextureFile::TileIndex(int layout, int tilesWide, int tilesHigh, int x, int y) {
+	if (layout != MEGA_LAYOUT_MORTON || !idMath::IsPowerOfTwo(tilesWide) || !idMath::IsPowerOfTwo(tilesHigh)) {
+		return y * tilesWide + x;
+	}
+
+	int		interleavedBits = idMath::ILog2(Min(tilesWide, tilesHigh));
+	int		index = 0;
+
+	for (int i = 0; i < interleavedBits; i++) {
+		index |= ((x >> i) & 1) << (2 * i);
+		index |= ((y >> i) & 1) << (2 * i + 1);
+	}
+
+	// whatever is left of the longer axis
+	int		high = (tilesWide > tilesHigh) ? x : y;
+	index |= (high >> interleavedBits) << (2 * interleavedBits);
+
+	return index;
+}
+
+/*
+===========================
+rvmMegaTextureFile::GetTileNum
+===========================
+*/
+int rvmMegaTextureFile::GetTileNum(const idTextureLevel &level, int x, int y) const {
+	return level.tileOffset + TileIndex(header.layout, level.tilesWide, level.tilesHigh, x, y);
+}
+
+/*
+========================
+rvmMegaTextureFile::DecompressTile
+========================
+*/
+bool rvmMegaTextureFile::DecompressTile(const byte *compressed, int compressedSize, byte *tileBuffer, int tileBytes) {
+	uLongf	destLen = tileBytes;
+
+	if (uncompress(tileBuffer, &destLen, compressed, compressedSize) != Z_OK) {
+		return false;
+	}
+	return (int)destLen == tileBytes;
+}
+
+/*
+========================
+rvmMegaTextureFile::GetTileExtent
+
+Where a tile sits in the file and how many bytes it takes up there.
+========================
+*/
+bool rvmMegaTextureFile::GetTileExtent(int tileNum, int64 &offset, int &length) const {
+	if (header.compression == MEGA_COMPRESSION_ZLIB) {
+		if (tileNum < 0 || tileNum >= tileTable.Num()) {
+			return false;
+		}
+		offset = tileTable[tileNum].offset;
+		length = tileTable[tileNum].size;
+		return true;
+	}
+
+	offset = (int64)tileNum * tileBytes;
+	length = tileBytes;
+	return tileNum >= 0;
 }
 
 /*
@@ -160,12 +631,358 @@ rvmMegaTextureFile *rvmMegaTextureFile::LoadMegaTextureFile(const char *name) {
 rvmMegaTextureFile::ReadTile
 ========================
 */
-void rvmMegaTextureFile::ReadTile(byte *tileBuffer, int tileNum) {
-	int		tileSize = TILE_SIZE * TILE_SIZE;
+const byte *rvmMegaTextureFile::ReadTile(byte *tileBuffer, int tileNum) {
+	int64	offset;
+	int		length;
+
+	if (!GetTileExtent(tileNum, offset, length)) {
+		common->Warning("rvmMegaTextureFile::ReadTile: tile %d out of range\n", tileNum);
+		memset(tileBuffer, 0, tileBytes);
+		return tileBuffer;
+	}
+
+	uint64 startTime = Sys_Microseconds();
+	const byte *data = ReadTileData(tileBuffer, tileNum, offset, length);
+	AddReadStats(1, reader.IsMapped() ? 0 : 1, length, Sys_Microseconds() - startTime);
+
+	return data;
+}
+
+/*
+========================
+rvmMegaTextureFile::ReadTileData
+========================
+*/
+const byte *rvmMegaTextureFile::ReadTileData(byte *tileBuffer, int tileNum, int64 offset, int length) {
+	const byte *mapped = reader.GetMappedData(offset, length);
+	if (mapped != nullptr) {
+		reader.TouchMappedData(mapped, length);
+
+		// stored as is
+		if (length == tileBytes) {
+			return mapped;
+		}
+	}
+
+	const byte *compressed = mapped;
+	byte *		readBuffer = nullptr;
+	if (compressed == nullptr) {
+		// the tile table makes sure a deflated tile is never bigger than the tile itself, so
+		// a staging buffer always holds it
+		readBuffer = (length == tileBytes) ? tileBuffer : stagingPool.Alloc();
+
+		if (!reader.ReadAt(readBuffer, offset, length)) {
+			common->Warning("rvmMegaTextureFile::ReadTile: failed to read tile %d\n", tileNum);
+			if (readBuffer != tileBuffer) {
+				stagingPool.Free(readBuffer);
+			}
+			memset(tileBuffer, 0, tileBytes);
+			return tileBuffer;
+		}
+
+		if (length == tileBytes) {
+			return tileBuffer;
+		}
+		compressed = readBuffer;
+	}
+
+	if (!DecompressTile(compressed, length, tileBuffer, tileBytes)) {
+		common->Warning("rvmMegaTextureFile::ReadTile: failed to decompress tile %d\n", tileNum);
+		memset(tileBuffer, 0, tileBytes);
+	}
+	if (readBuffer != nullptr) {
+		stagingPool.Free(readBuffer);
+	}
+	return tileBuffer;
+}
 
-	fileHandle->Seek(tileNum * tileSize, FS_SEEK_SET);
-	//memset(data, 128, sizeof(data));
-	fileHandle->Read(tileBuffer, tileSize);
+struct megaTileRead_t {
+	int64	offset;
+	int		length;
+	int		index;					// into the caller's arrays
+};
+
+/*
+========================
+R_CompareTileReads
+========================
+*/
+static int R_CompareTileReads(const megaTileRead_t *a, const megaTileRead_t *b) {
+	if (a->offset != b->offset) {
+		return (a->offset < b->offset) ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+========================
+rvmMegaTextureFile::ReadTiles
+
+A window step wants a whole row or column of tiles, and with the Morton layout most of those are
+neighbors in the file. Sorting the tiles by offset and reading each run of neighbors with one read
+turns a row of seeks and reads into one or two. A mapped file has nothing to gain, there every
+tile is just a pointer.
+========================
+*/
+void rvmMegaTextureFile::ReadTiles(const int *tileNums, int numTiles, byte * const *tileBuffers, const byte **tileData) {
+	static const int MAX_COALESCED_READ = 1024 * 1024;
+	static const int MAX_READ_GAP = 16 * 1024;				// reading over a small hole is cheaper than another seek
+
+	if (reader.IsMapped() || numTiles == 1) {
+		for (int i = 0; i < numTiles; i++) {
+			tileData[i] = ReadTile(tileBuffers[i], tileNums[i]);
+		}
+		return;
+	}
+
+	idList<megaTileRead_t> reads;
+	reads.SetGranularity(16);
+
+	for (int i = 0; i < numTiles; i++) {
+		megaTileRead_t read;
+
+		if (!GetTileExtent(tileNums[i], read.offset, read.length)) {
+			// let ReadTile complain about it
+			tileData[i] = ReadTile(tileBuffers[i], tileNums[i]);
+			continue;
+		}
+		read.index = i;
+		reads.Append(read);
+	}
+
+	reads.Sort(R_CompareTileReads);
+
+	byte *	runBuffer = nullptr;
+	int		runBufferSize = 0;
+
+	for (int first = 0; first < reads.Num(); ) {
+		int64	runStart = reads[first].offset;
+		int64	runEnd = runStart + reads[first].length;
+		int		last = first + 1;
+
+		while (last < reads.Num()) {
+			const megaTileRead_t &next = reads[last];
+			int64 nextEnd = Max(runEnd, next.offset + next.length);
+
+			if (next.offset > runEnd + MAX_READ_GAP || nextEnd - runStart > MAX_COALESCED_READ) {
+				break;
+			}
+			runEnd = nextEnd;
+			last++;
+		}
+
+		// a run never gets past MAX_COALESCED_READ, so its length fits in an int
+		int runLength = (int)(runEnd - runStart);
+
+		if (runLength > runBufferSize) {
+			if (runBuffer != nullptr) {
+				Mem_Free(runBuffer);
+			}
+			runBufferSize = runLength;
+			runBuffer = (byte *)Mem_Alloc(runBufferSize);
+		}
+
+		uint64 startTime = Sys_Microseconds();
+		bool readOk = reader.ReadAt(runBuffer, runStart, runLength);
+
+		for (int i = first; i < last; i++) {
+			const megaTileRead_t &read = reads[i];
+			byte *tileBuffer = tileBuffers[read.index];
+			const byte *stored = runBuffer + read.offset - runStart;
+
+			tileData[read.index] = tileBuffer;
+
+			if (!readOk) {
+				tileData[read.index] = ReadTile(tileBuffer, tileNums[read.index]);
+			}
+			else if (read.length == tileBytes) {
+				memcpy(tileBuffer, stored, tileBytes);
+			}
+			else if (!DecompressTile(stored, read.length, tileBuffer, tileBytes)) {
+				common->Warning("rvmMegaTextureFile::ReadTiles: failed to decompress tile %d\n", tileNums[read.index]);
+				memset(tileBuffer, 0, tileBytes);
+			}
+		}
+
+		AddReadStats(last - first, 1, runLength, Sys_Microseconds() - startTime);
+
+		first = last;
+	}
+
+	if (runBuffer != nullptr) {
+		Mem_Free(runBuffer);
+	}
+}
+
+/*
+========================
+rvmMegaTextureFile::FetchTile
+========================
+*/
+const byte *rvmMegaTextureFile::FetchTile(byte *tileBuffer, int tileNum) {
+	const byte *data;
+
+	FetchTiles(&tileNum, 1, &tileBuffer, &data);
+	return data;
+}
+
+/*
+========================
+rvmMegaTextureFile::FetchTiles
+========================
+*/
+void rvmMegaTextureFile::FetchTiles(const int *tileNums, int numTiles, byte * const *tileBuffers, const byte **tileData) {
+	idTempArray<int> missNums(numTiles);
+	idTempArray<int> missIndexes(numTiles);
+	idTempArray<byte *> missBuffers(numTiles);
+	idTempArray<const byte *> missData(numTiles);
+	int numMisses = 0;
+
+	for (int i = 0; i < numTiles; i++) {
+		// a raw tile in the mapping is already a pointer, copying it in and out of the cache only costs
+		if (!IsTileCacheable(tileNums[i])) {
+			tileData[i] = ReadTile(tileBuffers[i], tileNums[i]);
+			continue;
+		}
+		if (tileCache.Lookup(tileNums[i], tileBuffers[i])) {
+			tileData[i] = tileBuffers[i];
+			continue;
+		}
+		missNums[numMisses] = tileNums[i];
+		missIndexes[numMisses] = i;
+		missBuffers[numMisses] = tileBuffers[i];
+		numMisses++;
+	}
+
+	if (numMisses == 0) {
+		return;
+	}
+
+	ReadTiles(missNums.Ptr(), numMisses, missBuffers.Ptr(), missData.Ptr());
+
+	for (int i = 0; i < numMisses; i++) {
+		tileCache.Insert(missNums[i], missData[i]);
+		tileData[missIndexes[i]] = missData[i];
+	}
+}
+
+/*
+========================
+rvmMegaTextureFile::TouchTile
+========================
+*/
+void rvmMegaTextureFile::TouchTile(int tileNum) {
+	int64	offset;
+	int		length;
+
+	if (!GetTileExtent(tileNum, offset, length)) {
+		return;
+	}
+
+	const byte *mapped = reader.GetMappedData(offset, length);
+	if (mapped != nullptr) {
+		reader.TouchMappedData(mapped, length);
+	}
+}
+
+/*
+========================
+rvmMegaTextureFile::IsTileCacheable
+
+Only tiles that cost a read or an inflate are worth a cache slot. A tile stored as is in a mapped
+file is handed out straight from the mapping, and the OS page cache already holds its pages.
+========================
+*/
+bool rvmMegaTextureFile::IsTileCacheable(int tileNum) const {
+	int64	offset;
+	int		length;
+
+	if (!reader.IsMapped()) {
+		return true;
+	}
+	if (!GetTileExtent(tileNum, offset, length)) {
+		return true;
+	}
+	return length != tileBytes;
+}
+
+/*
+===========================
+rvmMegaTextureFile::QueueUpload
+===========================
+*/
+void rvmMegaTextureFile::QueueUpload(const megaTileRequest_t &request) {
+	pendingUploads.Append(request);
+}
+
+/*
+===========================
+rvmMegaTextureFile::UploadCompletedTiles
+
+Everything that has been read waits in pendingUploads, each frame only uploads as many tiles as
+r_megaTextureUploadTiles and r_megaTextureUploadTime allow. A level stays masked until all of its
+tiles made it, so the coarser levels cover for it in the meantime.
+===========================
+*/
+void rvmMegaTextureFile::UploadCompletedTiles(void) {
+	streamer->GetCompletedTiles(pendingUploads);
+	if (pendingUploads.Num() == 0) {
+		return;
+	}
+
+	// sorted by level first, so the batch only binds each level image once
+	pendingUploads.Sort(R_CompareTileRequests);
+
+	rvmMegaTextureUploadBackend *backend = GetUploadBackend();
+	backend->BeginBatch();
+
+	int		maxTiles = idMegaTexture::r_megaTextureUploadTiles.GetInteger();
+	int		maxTime = idMegaTexture::r_megaTextureUploadTime.GetInteger();
+	uint64	startTime = Sys_Microseconds();
+	int		numUploaded = 0;
+	int		numRemaining = 0;
+
+	for (int i = 0; i < pendingUploads.Num(); i++) {
+		megaTileRequest_t &request = pendingUploads[i];
+		idTextureTile *tile = &request.level->tileMap[request.localX][request.localY];
+
+		// the window moved on while this tile was waiting
+		bool stale = (tile->requestedX != request.globalX || tile->requestedY != request.globalY);
+
+		if (!stale) {
+			// always get at least one tile in, otherwise a tiny budget would never finish a level
+			bool overBudget = (maxTiles > 0 && numUploaded >= maxTiles) || (maxTime > 0 && Sys_Microseconds() - startTime >= (uint64)maxTime);
+			if (numUploaded > 0 && overBudget) {
+				pendingUploads[numRemaining++] = request;
+				continue;
+			}
+
+			request.level->UploadTile(request.localX, request.localY, request.globalX, request.globalY, request.data);
+			request.level->stats.numUploads++;
+			request.level->stats.AddLatency(Sys_Microseconds() - request.queueTime);
+			numUploaded++;
+		}
+		else {
+			request.level->stats.numStale++;
+		}
+
+		if (request.buffer != nullptr) {
+			stagingPool.Free(request.buffer);
+		}
+	}
+	pendingUploads.SetNum(numRemaining);
+
+	backend->EndBatch();
+
+	// a frame that only threw away stale tiles didn't upload anything
+	if (numUploaded > 0) {
+		idScopedCriticalSection lock(statsLock);
+		stats.numUploadFrames++;
+	}
+
+	for (int i = 0; i < numLevels; i++) {
+		levels[i].UpdateResidency();
+	}
 }
 
 /*
@@ -174,18 +991,43 @@ rvmMegaTextureFile::UpdateForCenter
 ===========================
 */
 void rvmMegaTextureFile::UpdateForCenter(float texCenter[2]) {
-	for (int i = 0; i < numLevels; i++) {
+	for (int i = numLevels - 1; i >= 0; i--) {
 		levels[i].UpdateForCenter(texCenter);
 	}
+
+	// every level has had its say, rank it all together.
+	streamer->ScheduleRequests();
 }
+/*
+===========================
+rvmMegaTextureFile::PrefetchForCenter
+===========================
+*/
+void rvmMegaTextureFile::PrefetchForCenter(const float texCenter[2]) {
+	// prefetched tiles go into the cache, without one there is nowhere to put them. Raw tiles in a
+	// mapping only get their pages touched, those are worth it either way.
+	if (tileCache.GetCacheSize() == 0 && !(reader.IsMapped() && header.compression == MEGA_COMPRESSION_NONE)) {
+		return;
+	}
+
+	// blurriest first, they cover the most screen.
+	for (int i = numLevels - 1; i >= 0; i--) {
+		levels[i].PrefetchForCenter(texCenter);
+	}
+}
+
 /*
 ===========================
 rvmMegaTextureFile::Invalidate
 ===========================
 */
 void rvmMegaTextureFile::Invalidate(void) {
+	// the pinned levels were read once at load and never change, reading them again on the
+	// render thread isn't worth a debug label, so they keep whatever they were loaded with.
 	for (int i = 0; i < numLevels; i++) {
-		levels[i].Invalidate();
+		if (!levels[i].pinned) {
+			levels[i].Invalidate();
+		}
 	}
 }
 
@@ -195,6 +1037,11 @@ rvmMegaTextureFile::BindForViewOrigin
 ===========================
 */
 void rvmMegaTextureFile::BindForViewOrigin(const idVec3 viewOrigin) {
+	static float	noContributionParms[4] = { -2, -2, 0, 1 };
+
+	// get anything the streaming thread finished into the level images before they get bound.
+	UploadCompletedTiles();
+
 	// borderClamp image goes in texture 0
 	GL_SelectTexture(0);
 	globalImages->borderClampImage->Bind();
@@ -206,9 +1053,8 @@ void rvmMegaTextureFile::BindForViewOrigin(const idVec3 viewOrigin) {
 		if (i >= numLevels) {
 			globalImages->whiteImage->Bind();
 
-			static float	parms[4] = { -2, -2, 0, 1 };	// no contribution
 			//glProgramLocalParameter4fvARB( GL_VERTEX_PROGRAM_ARB, i, parms );
-			renderProgManager.SetUniformValue((const renderParm_t)(RENDERPARM_MEGALEVEL0 + i), parms);
+			renderProgManager.SetUniformValue((const renderParm_t)(RENDERPARM_MEGALEVEL0 + i), noContributionParms);
 		}
 		else {
 			idTextureLevel	*level = &levels[numLevels - 1 - i];
@@ -221,11 +1067,16 @@ void rvmMegaTextureFile::BindForViewOrigin(const idVec3 viewOrigin) {
 					globalImages->whiteImage->Bind();
 				}
 			}
+			else if (level->image == nullptr) {
+				// nothing has been uploaded yet, the level is masked out anyway
+				globalImages->whiteImage->Bind();
+			}
 			else {
 				level->image->Bind();
 			}
 			//glProgramLocalParameter4fvARB( GL_VERTEX_PROGRAM_ARB, i, level->parms );
-			renderProgManager.SetUniformValue((const renderParm_t)(RENDERPARM_MEGALEVEL0 + i), level->parms);
+			// mask out levels that are still streaming, the coarser levels show through instead.
+			renderProgManager.SetUniformValue((const renderParm_t)(RENDERPARM_MEGALEVEL0 + i), level->resident ? level->parms : noContributionParms);
 		}
 	}
 
@@ -0,0 +1,271 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+#include <limits.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/*
+===========================
+rvmMegaTextureReader::rvmMegaTextureReader
+===========================
+*/
+rvmMegaTextureReader::rvmMegaTextureReader() {
+	file = nullptr;
+	length = 0;
+	mappedData = nullptr;
+#ifdef _WIN32
+	osHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	osHandle = -1;
+#endif
+}
+
+/*
+===========================
+rvmMegaTextureReader::~rvmMegaTextureReader
+===========================
+*/
+rvmMegaTextureReader::~rvmMegaTextureReader() {
+	Close();
+}
+
+/*
+===========================
+rvmMegaTextureReader::Open
+===========================
+*/
+bool rvmMegaTextureReader::Open(const char *name) {
+	Close();
+
+	file = fileSystem->OpenFileRead(name);
+	if (file == nullptr) {
+		return false;
+	}
+
+	length = file->Length();
+
+	// If this is a loose file GetFullPath is something the OS can open, for files
+	// inside a pk4 the open fails and we just keep reading through idFile. The OS knows the
+	// real length, idFile only goes up to 2 GB.
+	const char *osPath = file->GetFullPath();
+#ifdef _WIN32
+	osHandle = CreateFileA(osPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (osHandle == INVALID_HANDLE_VALUE) {
+		return true;
+	}
+
+	LARGE_INTEGER osLength;
+	if (!GetFileSizeEx(osHandle, &osLength) || (osLength.QuadPart <= INT_MAX && osLength.QuadPart != length)) {
+		CloseHandle(osHandle);
+		osHandle = INVALID_HANDLE_VALUE;
+		return true;
+	}
+	length = osLength.QuadPart;
+
+	mappingHandle = CreateFileMappingA(osHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle != NULL) {
+		mappedData = (byte *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	osHandle = open(osPath, O_RDONLY);
+	if (osHandle == -1) {
+		return true;
+	}
+
+	struct stat osStat;
+	if (fstat(osHandle, &osStat) != 0 || (osStat.st_size <= INT_MAX && osStat.st_size != length)) {
+		close(osHandle);
+		osHandle = -1;
+		return true;
+	}
+	length = osStat.st_size;
+
+	// a 32 bit build can't map a file bigger than its address space, pread still gets at all of it
+	void *mapping = ((uint64)length <= (uint64)(size_t)-1) ? mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, osHandle, 0) : MAP_FAILED;
+	if (mapping != MAP_FAILED) {
+		// tiles get pulled from all over the file, read ahead only wastes page cache.
+		madvise(mapping, length, MADV_RANDOM);
+		mappedData = (byte *)mapping;
+	}
+#endif
+
+	// Either mapped or reading with positional reads on the OS handle, idFile isn't needed anymore.
+	fileSystem->CloseFile(file);
+	file = nullptr;
+
+	return true;
+}
+
+/*
+===========================
+rvmMegaTextureReader::Close
+===========================
+*/
+void rvmMegaTextureReader::Close(void) {
+#ifdef _WIN32
+	if (mappedData != nullptr) {
+		UnmapViewOfFile(mappedData);
+	}
+	if (mappingHandle != NULL) {
+		CloseHandle(mappingHandle);
+		mappingHandle = NULL;
+	}
+	if (osHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(osHandle);
+		osHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (mappedData != nullptr) {
+		munmap(mappedData, length);
+	}
+	if (osHandle != -1) {
+		close(osHandle);
+		osHandle = -1;
+	}
+#endif
+	mappedData = nullptr;
+
+	if (file != nullptr) {
+		fileSystem->CloseFile(file);
+		file = nullptr;
+	}
+
+	length = 0;
+}
+
+/*
+===========================
+rvmMegaTextureReader::GetMappedData
+===========================
+*/
+const byte *rvmMegaTextureReader::GetMappedData(int64 offset, int length) const {
+	if (mappedData == nullptr || offset < 0 || offset + length > this->length) {
+		return nullptr;
+	}
+	return mappedData + offset;
+}
+
+/*
+===========================
+rvmMegaTextureReader::TouchMappedData
+
+A mapped tile isn't actually read until somebody touches it, do that on the streaming
+thread so the render thread doesn't eat the page faults during the upload.
+===========================
+*/
+void rvmMegaTextureReader::TouchMappedData(const byte *data, int length) const {
+	static const int MAPPED_PAGE_SIZE = 4096;
+	volatile byte sum = 0;
+
+	for (int i = 0; i < length; i += MAPPED_PAGE_SIZE) {
+		sum += data[i];
+	}
+	sum += data[length - 1];
+}
+
+/*
+===========================
+rvmMegaTextureReader::ReadAt
+===========================
+*/
+bool rvmMegaTextureReader::ReadAt(void *buffer, int64 offset, int length) {
+	if (offset < 0 || offset + length > this->length) {
+		return false;
+	}
+
+	if (mappedData != nullptr) {
+		memcpy(buffer, mappedData + offset, length);
+		return true;
+	}
+
+	// a positional read can come back short or be interrupted, keep going until it is all in
+	// and only give up on the end of the file or a real error
+#ifdef _WIN32
+	if (osHandle != INVALID_HANDLE_VALUE) {
+		byte *	dest = (byte *)buffer;
+		int		remaining = length;
+
+		while (remaining > 0) {
+			OVERLAPPED overlapped;
+			DWORD bytesRead = 0;
+			int64 readOffset = offset + (length - remaining);
+
+			memset(&overlapped, 0, sizeof(overlapped));
+			overlapped.Offset = (DWORD)readOffset;
+			overlapped.OffsetHigh = (DWORD)(readOffset >> 32);
+			if (!ReadFile(osHandle, dest, remaining, &bytesRead, &overlapped) || bytesRead == 0) {
+				return false;
+			}
+			dest += bytesRead;
+			remaining -= bytesRead;
+		}
+		return true;
+	}
+#else
+	if (osHandle != -1) {
+		byte *	dest = (byte *)buffer;
+		int		remaining = length;
+
+		while (remaining > 0) {
+			ssize_t bytesRead = pread(osHandle, dest, remaining, offset + (length - remaining));
+
+			if (bytesRead < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytesRead <= 0) {
+				return false;
+			}
+			dest += bytesRead;
+			remaining -= (int)bytesRead;
+		}
+		return true;
+	}
+#endif
+
+	// idFile keeps its own position, so only one thread can be in here at a time.
+	idScopedCriticalSection lock(fileLock);
+
+	rvmMegaTextureFile::SeekFile(file, offset);
+	return file->Read(buffer, length) == length;
+}
@@ -0,0 +1,273 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+/*
+===========================
+megaLevelStats_t::AddLatency
+===========================
+*/
+void megaLevelStats_t::AddLatency(uint64 microseconds) {
+	int bucket = 0;
+	while (bucket < MEGA_LATENCY_BUCKETS - 1 && microseconds >= (uint64)(1000 << bucket)) {
+		bucket++;
+	}
+
+	latency[bucket]++;
+	totalLatencyMicroseconds += microseconds;
+	maxLatencyMicroseconds = Max(maxLatencyMicroseconds, microseconds);
+}
+
+/*
+===========================
+rvmMegaTextureFile::AddReadStats
+===========================
+*/
+void rvmMegaTextureFile::AddReadStats(int numTiles, int numReadCalls, int64 numBytes, uint64 microseconds) {
+	idScopedCriticalSection lock(statsLock);
+
+	stats.numTileReads += numTiles;
+	stats.numReadCalls += numReadCalls;
+	stats.numBytesRead += numBytes;
+	stats.readMicroseconds += microseconds;
+}
+
+/*
+===========================
+rvmMegaTextureFile::ClearStats
+===========================
+*/
+void rvmMegaTextureFile::ClearStats(void) {
+	{
+		idScopedCriticalSection lock(statsLock);
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	for (int i = 0; i < numLevels; i++) {
+		memset(&levels[i].stats, 0, sizeof(levels[i].stats));
+	}
+	tileCache.ClearStats();
+}
+
+/*
+===========================
+rvmMegaTextureFile::PrintStats
+===========================
+*/
+void rvmMegaTextureFile::PrintStats(void) {
+	megaFileStats_t fileStats;
+	{
+		idScopedCriticalSection lock(statsLock);
+		fileStats = stats;
+	}
+
+	common->Printf("%s: %d x %d tiles of %d, %d tiles per level\n", name.c_str(), header.tilesWide, header.tilesHigh, tileSize, tilesPerLevel);
+	common->Printf("  reads: %d tiles in %d reads, %lld KB, %.2f ms\n", fileStats.numTileReads, fileStats.numReadCalls,
+		fileStats.numBytesRead / 1024, fileStats.readMicroseconds / 1000.0f);
+	int lookups = tileCache.GetNumHits() + tileCache.GetNumMisses();
+	common->Printf("  cache: %d/%d tiles cached (%d MB), %d hits %d misses (%.1f%% hit rate)\n",
+		tileCache.GetNumCachedTiles(), tileCache.GetCacheSize() / tileBytes, tileCache.GetCacheSize() / (1024 * 1024),
+		tileCache.GetNumHits(), tileCache.GetNumMisses(), lookups > 0 ? 100.0f * tileCache.GetNumHits() / lookups : 0.0f);
+	common->Printf("  staging: %d buffers %d overflows, %d upload frames\n",
+		stagingPool.GetNumBuffers(), stagingPool.GetNumOverflows(), fileStats.numUploadFrames);
+
+	common->Printf("  level   tiles requests  offmap cancels uploads   stale  update ms  mean ms   max ms\n");
+	for (int i = 0; i < numLevels; i++) {
+		const idTextureLevel &level = levels[i];
+		const megaLevelStats_t &levelStats = level.stats;
+
+		common->Printf("  %5d %3dx%-3d %8d %7d %7d %7d %7d %10.2f %8.2f %8.2f%s\n", i, level.tilesWide, level.tilesHigh,
+			levelStats.numRequests, levelStats.numOffMap, levelStats.numCancels, levelStats.numUploads, levelStats.numStale,
+			levelStats.updateMicroseconds / 1000.0f,
+			levelStats.numUploads > 0 ? levelStats.totalLatencyMicroseconds / 1000.0f / levelStats.numUploads : 0.0f,
+			levelStats.maxLatencyMicroseconds / 1000.0f, level.pinned ? " pinned" : "");
+	}
+
+	// latency histogram, one column per bucket
+	idStr line = "  latency <ms";
+	for (int b = 0; b < MEGA_LATENCY_BUCKETS - 1; b++) {
+		line += va(" %5d", 1 << b);
+	}
+	line += "  more";
+	common->Printf("%s\n", line.c_str());
+
+	for (int i = 0; i < numLevels; i++) {
+		line = va("  level %-5d", i);
+		for (int b = 0; b < MEGA_LATENCY_BUCKETS; b++) {
+			line += va(" %5d", levels[i].stats.latency[b]);
+		}
+		common->Printf("%s\n", line.c_str());
+	}
+}
+
+/*
+===========================
+R_EscapeMegaStatsString
+
+Escapes a string for a JSON value, file names can have quotes and backslashes in them.
+===========================
+*/
+static idStr R_EscapeMegaStatsString(const char *s) {
+	idStr escaped;
+
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			escaped += '\\';
+			escaped += *s;
+		}
+		else if ((unsigned char)*s < ' ') {
+			escaped += va("\\u%04x", (unsigned char)*s);
+		}
+		else {
+			escaped += *s;
+		}
+	}
+	return escaped;
+}
+
+/*
+===========================
+rvmMegaTextureFile::WriteStats
+
+One JSON object per file, so the dumps of two builds can be diffed by a script.
+===========================
+*/
+void rvmMegaTextureFile::WriteStats(idFile *f, bool last) {
+	megaFileStats_t fileStats;
+	{
+		idScopedCriticalSection lock(statsLock);
+		fileStats = stats;
+	}
+
+	f->Printf("\t\t{\n");
+	f->Printf("\t\t\t\"name\": \"%s\",\n", R_EscapeMegaStatsString(name.c_str()).c_str());
+	f->Printf("\t\t\t\"tileSize\": %d,\n", tileSize);
+	f->Printf("\t\t\t\"tilesPerLevel\": %d,\n", tilesPerLevel);
+	f->Printf("\t\t\t\"tileReads\": %d,\n", fileStats.numTileReads);
+	f->Printf("\t\t\t\"readCalls\": %d,\n", fileStats.numReadCalls);
+	f->Printf("\t\t\t\"bytesRead\": %lld,\n", fileStats.numBytesRead);
+	f->Printf("\t\t\t\"readMicroseconds\": %llu,\n", fileStats.readMicroseconds);
+	f->Printf("\t\t\t\"cacheHits\": %d,\n", tileCache.GetNumHits());
+	f->Printf("\t\t\t\"cacheMisses\": %d,\n", tileCache.GetNumMisses());
+	f->Printf("\t\t\t\"cachedTiles\": %d,\n", tileCache.GetNumCachedTiles());
+	f->Printf("\t\t\t\"stagingOverflows\": %d,\n", stagingPool.GetNumOverflows());
+	f->Printf("\t\t\t\"uploadFrames\": %d,\n", fileStats.numUploadFrames);
+	f->Printf("\t\t\t\"levels\": [\n");
+
+	for (int i = 0; i < numLevels; i++) {
+		const megaLevelStats_t &levelStats = levels[i].stats;
+
+		f->Printf("\t\t\t\t{ \"level\": %d, \"tilesWide\": %d, \"tilesHigh\": %d, \"pinned\": %s, ", i, levels[i].tilesWide, levels[i].tilesHigh, levels[i].pinned ? "true" : "false");
+		f->Printf("\"requests\": %d, \"offMap\": %d, \"cancels\": %d, \"uploads\": %d, \"stale\": %d, ",
+			levelStats.numRequests, levelStats.numOffMap, levelStats.numCancels, levelStats.numUploads, levelStats.numStale);
+		f->Printf("\"updateMicroseconds\": %llu, \"totalLatencyMicroseconds\": %llu, \"maxLatencyMicroseconds\": %llu, \"latency\": [",
+			levelStats.updateMicroseconds, levelStats.totalLatencyMicroseconds, levelStats.maxLatencyMicroseconds);
+		for (int b = 0; b < MEGA_LATENCY_BUCKETS; b++) {
+			f->Printf(b == 0 ? "%d" : ", %d", levelStats.latency[b]);
+		}
+		f->Printf("] }%s\n", i == numLevels - 1 ? "" : ",");
+	}
+
+	f->Printf("\t\t\t]\n");
+	f->Printf("\t\t}%s\n", last ? "" : ",");
+}
+
+/*
+===========================
+rvmMegaTextureFile::StatsCommand
+
+megaStats				prints the streaming counters of every loaded megatexture
+megaStats clear			resets them
+megaStats dump [file]	writes them out as JSON, megastats.json by default
+===========================
+*/
+void rvmMegaTextureFile::StatsCommand(const idCmdArgs &args) {
+	idList<rvmMegaTextureFile *> &files = loadedFiles;
+
+	if (args.Argc() > 1 && !idStr::Icmp(args.Argv(1), "clear")) {
+		for (int i = 0; i < files.Num(); i++) {
+			files[i]->ClearStats();
+		}
+		GetUploadBackend()->ClearCounters();
+		return;
+	}
+
+	const rvmMegaTextureUploadBackend *backend = GetUploadBackend();
+
+	if (args.Argc() > 1 && !idStr::Icmp(args.Argv(1), "dump")) {
+		const char *fileName = (args.Argc() > 2) ? args.Argv(2) : "megastats.json";
+
+		idFile *f = fileSystem->OpenFileWrite(fileName);
+		if (f == nullptr) {
+			common->Printf("megaStats: couldn't open %s\n", fileName);
+			return;
+		}
+
+		f->Printf("{\n");
+		f->Printf("\t\"latencyBucketMilliseconds\": [");
+		for (int b = 0; b < MEGA_LATENCY_BUCKETS - 1; b++) {
+			f->Printf(b == 0 ? "%d" : ", %d", 1 << b);
+		}
+		f->Printf("],\n");
+		f->Printf("\t\"uploadBatches\": %d,\n", backend->numBatches);
+		f->Printf("\t\"uploadBinds\": %d,\n", backend->numBinds);
+		f->Printf("\t\"uploads\": %d,\n", backend->numUploads);
+		f->Printf("\t\"uploadedBytes\": %lld,\n", backend->numUploadedBytes);
+		f->Printf("\t\"files\": [\n");
+		for (int i = 0; i < files.Num(); i++) {
+			files[i]->WriteStats(f, i == files.Num() - 1);
+		}
+		f->Printf("\t]\n");
+		f->Printf("}\n");
+
+		delete f;
+		common->Printf("megaStats: wrote %s\n", fileName);
+		return;
+	}
+
+	common->Printf("uploads: %d tiles, %lld KB in %d batches with %d binds\n", backend->numUploads, backend->numUploadedBytes / 1024, backend->numBatches, backend->numBinds);
+	for (int i = 0; i < files.Num(); i++) {
+		files[i]->PrintStats();
+	}
+}
+
+/*
+===========================
+megaStats
+===========================
+*/
+CONSOLE_COMMAND(megaStats, "prints or dumps the megatexture streaming stats, megaStats [clear | dump [file]]", 0) {
+	rvmMegaTextureFile::StatsCommand(args);
+}
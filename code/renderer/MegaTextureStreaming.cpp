@@ -0,0 +1,372 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+idCVar idMegaTexture::r_megaTextureStreamThread("r_megaTextureStreamThread", "1", CVAR_RENDERER | CVAR_BOOL, "read megatexture tiles on the streaming thread instead of the render thread");
+
+/*
+===========================
+rvmMegaTextureStreamer::rvmMegaTextureStreamer
+===========================
+*/
+rvmMegaTextureStreamer::rvmMegaTextureStreamer(rvmMegaTextureFile *mega) {
+	this->mega = mega;
+	prefetchBuffer = nullptr;
+	pendingSorted = true;
+	numInFlight = 0;
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::~rvmMegaTextureStreamer
+===========================
+*/
+rvmMegaTextureStreamer::~rvmMegaTextureStreamer() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::Start
+===========================
+*/
+void rvmMegaTextureStreamer::Start(void) {
+	StartWorkerThread("MegaTextureStreamer", CORE_ANY, THREAD_BELOW_NORMAL);
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::Shutdown
+===========================
+*/
+void rvmMegaTextureStreamer::Shutdown(void) {
+	StopThread(true);
+
+	// anything that finished but never got uploaded still owns its tile data.
+	idScopedCriticalSection lock(requestLock);
+	for (int i = 0; i < completedRequests.Num(); i++) {
+		if (completedRequests[i].buffer != nullptr) {
+			mega->stagingPool.Free(completedRequests[i].buffer);
+		}
+	}
+	completedRequests.Clear();
+	pendingRequests.Clear();
+	prefetchRequests.Clear();
+
+	if (prefetchBuffer != nullptr) {
+		Mem_Free(prefetchBuffer);
+		prefetchBuffer = nullptr;
+	}
+}
+
+/*
+===========================
+R_CompareTileRequests
+
+Coarser levels cover more of the screen and are what shows through while the finer ones
+are still masked, so they always go first. Within a level the tiles nearest the view win.
+===========================
+*/
+int R_CompareTileRequests(const megaTileRequest_t *a, const megaTileRequest_t *b) {
+	if (a->levelRank != b->levelRank) {
+		return a->levelRank - b->levelRank;
+	}
+	if (a->distance < b->distance) {
+		return -1;
+	}
+	if (a->distance > b->distance) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+===========================
+R_CompareTileRequestsReversed
+===========================
+*/
+static int R_CompareTileRequestsReversed(const megaTileRequest_t *a, const megaTileRequest_t *b) {
+	return R_CompareTileRequests(b, a);
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::QueueTile
+===========================
+*/
+void rvmMegaTextureStreamer::QueueTile(const megaTileRequest_t &request) {
+	idScopedCriticalSection lock(requestLock);
+
+	pendingSorted = false;
+
+	// A slot only ever waits on one tile, if the window moved before the old read got serviced just retarget it.
+	for (int i = 0; i < pendingRequests.Num(); i++) {
+		megaTileRequest_t &pending = pendingRequests[i];
+		if (pending.level == request.level && pending.localX == request.localX && pending.localY == request.localY) {
+			pending = request;
+			return;
+		}
+	}
+
+	pendingRequests.Append(request);
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::CancelTile
+===========================
+*/
+bool rvmMegaTextureStreamer::CancelTile(const idTextureLevel *level, int localX, int localY) {
+	idScopedCriticalSection lock(requestLock);
+
+	for (int i = 0; i < pendingRequests.Num(); i++) {
+		const megaTileRequest_t &pending = pendingRequests[i];
+		if (pending.level == level && pending.localX == localX && pending.localY == localY) {
+			// removing keeps the order, so a sorted list stays sorted
+			pendingRequests.RemoveIndex(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::ScheduleRequests
+===========================
+*/
+void rvmMegaTextureStreamer::ScheduleRequests(void) {
+	{
+		idScopedCriticalSection lock(requestLock);
+
+		if (pendingRequests.Num() == 0) {
+			return;
+		}
+
+		// the view has moved since the older requests were ranked
+		for (int i = 0; i < pendingRequests.Num(); i++) {
+			megaTileRequest_t &pending = pendingRequests[i];
+			const idTextureLevel *level = pending.level;
+
+			pending.distance = idMath::Sqrt(Square(pending.globalX + 0.5f - level->viewTile[0]) + Square(pending.globalY + 0.5f - level->viewTile[1]));
+		}
+		pendingSorted = false;
+	}
+
+	// Without the streaming thread the reads happen right here, the uploads still go through the completed list.
+	if (!idMegaTexture::r_megaTextureStreamThread.GetBool()) {
+		megaTileRequest_t requests[MAX_REQUEST_BATCH];
+		int numRequests;
+
+		while ((numRequests = GetNextRequests(requests, MAX_REQUEST_BATCH)) > 0) {
+			ServiceRequests(requests, numRequests);
+		}
+		return;
+	}
+
+	SignalWork();
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::GetNextRequests
+
+Pops up to maxRequests of the most important tile requests, the list is only re-sorted when
+something was queued.
+===========================
+*/
+int rvmMegaTextureStreamer::GetNextRequests(megaTileRequest_t *requests, int maxRequests) {
+	idScopedCriticalSection lock(requestLock);
+
+	if (pendingRequests.Num() == 0) {
+		return 0;
+	}
+
+	if (!pendingSorted) {
+		pendingRequests.Sort(R_CompareTileRequestsReversed);
+		pendingSorted = true;
+	}
+
+	int numRequests = Min(maxRequests, pendingRequests.Num());
+	for (int i = 0; i < numRequests; i++) {
+		requests[i] = pendingRequests[pendingRequests.Num() - 1 - i];
+	}
+	pendingRequests.SetNum(pendingRequests.Num() - numRequests);
+	numInFlight += numRequests;
+
+	return numRequests;
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::QueuePrefetch
+===========================
+*/
+void rvmMegaTextureStreamer::QueuePrefetch(int tileNum) {
+	static const int MAX_PREFETCH_REQUESTS = 256;
+
+	// prefetching on the render thread would just be a slower demand load.
+	if (!idMegaTexture::r_megaTextureStreamThread.GetBool()) {
+		return;
+	}
+
+	{
+		idScopedCriticalSection lock(requestLock);
+
+		if (prefetchRequests.FindIndex(tileNum) != -1) {
+			return;
+		}
+
+		// the oldest predictions are the most likely to be wrong by now.
+		if (prefetchRequests.Num() >= MAX_PREFETCH_REQUESTS) {
+			prefetchRequests.RemoveIndex(0);
+		}
+		prefetchRequests.Append(tileNum);
+	}
+
+	SignalWork();
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::GetCompletedTiles
+===========================
+*/
+void rvmMegaTextureStreamer::GetCompletedTiles(idList<megaTileRequest_t> &completed) {
+	idScopedCriticalSection lock(requestLock);
+
+	for (int i = 0; i < completedRequests.Num(); i++) {
+		completed.Append(completedRequests[i]);
+	}
+	completedRequests.SetNum(0);
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::IsIdle
+===========================
+*/
+bool rvmMegaTextureStreamer::IsIdle(void) {
+	idScopedCriticalSection lock(requestLock);
+	return pendingRequests.Num() == 0 && numInFlight == 0;
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::ServiceRequests
+
+The batch is read together, so a row of tiles that sit next to each other in the file is one read.
+===========================
+*/
+void rvmMegaTextureStreamer::ServiceRequests(megaTileRequest_t *requests, int numRequests) {
+	int			tileNums[MAX_REQUEST_BATCH];
+	byte *		tileBuffers[MAX_REQUEST_BATCH];
+	const byte *tileData[MAX_REQUEST_BATCH];
+
+	// cache hits get copied into the buffer, misses on a mapped file still hand back a pointer into the mapping.
+	for (int i = 0; i < numRequests; i++) {
+		requests[i].buffer = mega->stagingPool.Alloc();
+		tileNums[i] = requests[i].tileNum;
+		tileBuffers[i] = requests[i].buffer;
+	}
+
+	mega->FetchTiles(tileNums, numRequests, tileBuffers, tileData);
+
+	idScopedCriticalSection lock(requestLock);
+	for (int i = 0; i < numRequests; i++) {
+		requests[i].data = tileData[i];
+		completedRequests.Append(requests[i]);
+	}
+	numInFlight -= numRequests;
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::ServicePrefetch
+===========================
+*/
+void rvmMegaTextureStreamer::ServicePrefetch(int tileNum) {
+	// a raw tile in the mapping stays out of the cache, but the mapping is random access so
+	// nothing reads ahead for us, fault its pages in now so the request finds them resident.
+	if (!mega->IsTileCacheable(tileNum)) {
+		mega->TouchTile(tileNum);
+		return;
+	}
+
+	if (mega->tileCache.Contains(tileNum)) {
+		return;
+	}
+
+	if (prefetchBuffer == nullptr) {
+		prefetchBuffer = (byte *)Mem_Alloc(mega->tileBytes);
+	}
+
+	mega->tileCache.Insert(tileNum, mega->ReadTile(prefetchBuffer, tileNum));
+}
+
+/*
+===========================
+rvmMegaTextureStreamer::Run
+
+Services requests until the queues are empty, SignalWork will wake us up again. Tile requests
+are always checked first so a prefetch never holds up something the view needs right now, and
+they come off in the order R_CompareTileRequests ranks them.
+===========================
+*/
+int rvmMegaTextureStreamer::Run(void) {
+	while (!IsTerminating()) {
+		megaTileRequest_t requests[MAX_REQUEST_BATCH];
+		int prefetchTileNum = -1;
+
+		int numRequests = GetNextRequests(requests, MAX_REQUEST_BATCH);
+		if (numRequests > 0) {
+			ServiceRequests(requests, numRequests);
+			continue;
+		}
+
+		{
+			idScopedCriticalSection lock(requestLock);
+			if (prefetchRequests.Num() == 0) {
+				break;
+			}
+			prefetchTileNum = prefetchRequests[0];
+			prefetchRequests.RemoveIndex(0);
+		}
+
+		ServicePrefetch(prefetchTileNum);
+	}
+
+	return 0;
+}
@@ -0,0 +1,650 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define MEGA_TGA_X86
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// gcc and clang only emit SSSE3 / AVX2 inside functions that ask for it, msvc always can
+#if defined( MEGA_TGA_X86 ) && !defined( _MSC_VER )
+#define MEGA_TGA_TARGET( x )	__attribute__(( target( x ) ))
+#else
+#define MEGA_TGA_TARGET( x )
+#endif
+
+enum megaTGADecodeLevel_t {
+	TGA_DECODE_GENERIC,
+	TGA_DECODE_SSSE3,
+	TGA_DECODE_AVX2,
+	TGA_DECODE_LEVELS
+};
+
+static const char *tgaDecodeLevelNames[TGA_DECODE_LEVELS] = { "generic", "SSSE3", "AVX2" };
+
+/*
+===========================
+R_DecodeTGARowGray_Generic
+===========================
+*/
+static void R_DecodeTGARowGray_Generic(const byte *in, byte *out, int columns, int scale) {
+	for (int x = 0; x < columns; x++) {
+		byte gray = in[x];
+
+		for (int f = 0; f < scale; f++) {
+			*out++ = gray;
+			*out++ = gray;
+			*out++ = gray;
+			*out++ = 255;
+		}
+	}
+}
+
+/*
+===========================
+R_DecodeTGARowBGR_Generic
+===========================
+*/
+static void R_DecodeTGARowBGR_Generic(const byte *in, byte *out, int columns, int scale) {
+	for (int x = 0; x < columns; x++, in += 3) {
+		for (int f = 0; f < scale; f++) {
+			*out++ = in[2];
+			*out++ = in[1];
+			*out++ = in[0];
+			*out++ = 255;
+		}
+	}
+}
+
+/*
+===========================
+R_DecodeTGARowBGRA_Generic
+===========================
+*/
+static void R_DecodeTGARowBGRA_Generic(const byte *in, byte *out, int columns, int scale) {
+	for (int x = 0; x < columns; x++, in += 4) {
+		for (int f = 0; f < scale; f++) {
+			*out++ = in[2];
+			*out++ = in[1];
+			*out++ = in[0];
+			*out++ = in[3];
+		}
+	}
+}
+
+#ifdef MEGA_TGA_X86
+
+/*
+===========================
+R_StoreScaled_SSSE3
+
+Writes four RGBA pixels each repeated scale times, scale is 1, 2 or 4.
+===========================
+*/
+MEGA_TGA_TARGET("ssse3") static inline void R_StoreScaled_SSSE3(byte *out, __m128i pixels, int scale) {
+	if (scale == 1) {
+		_mm_storeu_si128((__m128i *)out, pixels);
+		return;
+	}
+
+	__m128i lo = _mm_unpacklo_epi32(pixels, pixels);		// 0 0 1 1
+	__m128i hi = _mm_unpackhi_epi32(pixels, pixels);		// 2 2 3 3
+
+	if (scale == 2) {
+		_mm_storeu_si128((__m128i *)(out + 0), lo);
+		_mm_storeu_si128((__m128i *)(out + 16), hi);
+		return;
+	}
+
+	_mm_storeu_si128((__m128i *)(out + 0), _mm_unpacklo_epi64(lo, lo));
+	_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi64(lo, lo));
+	_mm_storeu_si128((__m128i *)(out + 32), _mm_unpacklo_epi64(hi, hi));
+	_mm_storeu_si128((__m128i *)(out + 48), _mm_unpackhi_epi64(hi, hi));
+}
+
+/*
+===========================
+R_DecodeTGARowGray_SSSE3
+===========================
+*/
+MEGA_TGA_TARGET("ssse3") static void R_DecodeTGARowGray_SSSE3(const byte *in, byte *out, int columns, int scale) {
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	const __m128i spread[4] = {
+		_mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1),
+		_mm_setr_epi8(4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1),
+		_mm_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1),
+		_mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1)
+	};
+
+	int x = 0;
+	for (; x + 16 <= columns; x += 16) {
+		__m128i gray = _mm_loadu_si128((const __m128i *)(in + x));
+
+		for (int i = 0; i < 4; i++) {
+			R_StoreScaled_SSSE3(out + (x + i * 4) * scale * 4, _mm_or_si128(_mm_shuffle_epi8(gray, spread[i]), alpha), scale);
+		}
+	}
+
+	R_DecodeTGARowGray_Generic(in + x, out + x * scale * 4, columns - x, scale);
+}
+
+/*
+===========================
+R_DecodeTGARowBGR_SSSE3
+===========================
+*/
+MEGA_TGA_TARGET("ssse3") static void R_DecodeTGARowBGR_SSSE3(const byte *in, byte *out, int columns, int scale) {
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	const __m128i swizzle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+
+	// four pixels are 12 bytes but the load is 16, stay clear of the end of the row
+	int x = 0;
+	for (; x + 6 <= columns; x += 4) {
+		__m128i bgr = _mm_loadu_si128((const __m128i *)(in + x * 3));
+
+		R_StoreScaled_SSSE3(out + x * scale * 4, _mm_or_si128(_mm_shuffle_epi8(bgr, swizzle), alpha), scale);
+	}
+
+	R_DecodeTGARowBGR_Generic(in + x * 3, out + x * scale * 4, columns - x, scale);
+}
+
+/*
+===========================
+R_DecodeTGARowBGRA_SSSE3
+===========================
+*/
+MEGA_TGA_TARGET("ssse3") static void R_DecodeTGARowBGRA_SSSE3(const byte *in, byte *out, int columns, int scale) {
+	const __m128i swizzle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	int x = 0;
+	for (; x + 4 <= columns; x += 4) {
+		__m128i bgra = _mm_loadu_si128((const __m128i *)(in + x * 4));
+
+		R_StoreScaled_SSSE3(out + x * scale * 4, _mm_shuffle_epi8(bgra, swizzle), scale);
+	}
+
+	R_DecodeTGARowBGRA_Generic(in + x * 4, out + x * scale * 4, columns - x, scale);
+}
+
+/*
+===========================
+R_StoreScaled_AVX2
+
+Writes eight RGBA pixels each repeated scale times. The unpacks work within each 128 bit lane,
+the permutes put the lanes back in pixel order.
+===========================
+*/
+MEGA_TGA_TARGET("avx2") static inline void R_StoreScaled_AVX2(byte *out, __m256i pixels, int scale) {
+	if (scale == 1) {
+		_mm256_storeu_si256((__m256i *)out, pixels);
+		return;
+	}
+
+	__m256i lo = _mm256_unpacklo_epi32(pixels, pixels);		// 0 0 1 1 | 4 4 5 5
+	__m256i hi = _mm256_unpackhi_epi32(pixels, pixels);		// 2 2 3 3 | 6 6 7 7
+
+	if (scale == 2) {
+		_mm256_storeu_si256((__m256i *)(out + 0), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+		return;
+	}
+
+	__m256i p0 = _mm256_unpacklo_epi64(lo, lo);				// 0 0 0 0 | 4 4 4 4
+	__m256i p1 = _mm256_unpackhi_epi64(lo, lo);				// 1 1 1 1 | 5 5 5 5
+	__m256i p2 = _mm256_unpacklo_epi64(hi, hi);				// 2 2 2 2 | 6 6 6 6
+	__m256i p3 = _mm256_unpackhi_epi64(hi, hi);				// 3 3 3 3 | 7 7 7 7
+
+	_mm256_storeu_si256((__m256i *)(out + 0), _mm256_permute2x128_si256(p0, p1, 0x20));
+	_mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+	_mm256_storeu_si256((__m256i *)(out + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+	_mm256_storeu_si256((__m256i *)(out + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+/*
+===========================
+R_DecodeTGARowGray_AVX2
+===========================
+*/
+MEGA_TGA_TARGET("avx2") static void R_DecodeTGARowGray_AVX2(const byte *in, byte *out, int columns, int scale) {
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i spread = _mm256_set1_epi32(0x00010101);
+
+	int x = 0;
+	for (; x + 8 <= columns; x += 8) {
+		__m256i gray = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + x)));
+
+		R_StoreScaled_AVX2(out + x * scale * 4, _mm256_or_si256(_mm256_mullo_epi32(gray, spread), alpha), scale);
+	}
+
+	R_DecodeTGARowGray_Generic(in + x, out + x * scale * 4, columns - x, scale);
+}
+
+/*
+===========================
+R_DecodeTGARowBGR_AVX2
+===========================
+*/
+MEGA_TGA_TARGET("avx2") static void R_DecodeTGARowBGR_AVX2(const byte *in, byte *out, int columns, int scale) {
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i swizzle = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+											 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+
+	// each lane gets four pixels, the second load ends 4 bytes past them
+	int x = 0;
+	for (; x + 10 <= columns; x += 8) {
+		const byte *src = in + x * 3;
+		__m256i bgr = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)), _mm_loadu_si128((const __m128i *)(src + 12)), 1);
+
+		R_StoreScaled_AVX2(out + x * scale * 4, _mm256_or_si256(_mm256_shuffle_epi8(bgr, swizzle), alpha), scale);
+	}
+
+	R_DecodeTGARowBGR_SSSE3(in + x * 3, out + x * scale * 4, columns - x, scale);
+}
+
+/*
+===========================
+R_DecodeTGARowBGRA_AVX2
+===========================
+*/
+MEGA_TGA_TARGET("avx2") static void R_DecodeTGARowBGRA_AVX2(const byte *in, byte *out, int columns, int scale) {
+	const __m256i swizzle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+											 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	int x = 0;
+	for (; x + 8 <= columns; x += 8) {
+		__m256i bgra = _mm256_loadu_si256((const __m256i *)(in + x * 4));
+
+		R_StoreScaled_AVX2(out + x * scale * 4, _mm256_shuffle_epi8(bgra, swizzle), scale);
+	}
+
+	R_DecodeTGARowBGRA_Generic(in + x * 4, out + x * scale * 4, columns - x, scale);
+}
+
+#endif
+
+/*
+===========================
+R_GetTGADecodeLevel
+
+What the cpu and OS support, looked up once.
+===========================
+*/
+static int R_GetTGADecodeLevel(void) {
+	static int level = -1;
+
+	if (level != -1) {
+		return level;
+	}
+
+	level = TGA_DECODE_GENERIC;
+#if defined( MEGA_TGA_X86 ) && defined( _MSC_VER )
+	int info[4];
+
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+
+	__cpuidex(info, 7, 0);
+	bool avx2 = avx && (info[1] & (1 << 5)) != 0;
+
+	if (avx2) {
+		level = TGA_DECODE_AVX2;
+	}
+	else if (ssse3) {
+		level = TGA_DECODE_SSSE3;
+	}
+#elif defined( MEGA_TGA_X86 )
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		level = TGA_DECODE_AVX2;
+	}
+	else if (__builtin_cpu_supports("ssse3")) {
+		level = TGA_DECODE_SSSE3;
+	}
+#endif
+	return level;
+}
+
+/*
+===========================
+R_GetTGARowDecoderForLevel
+===========================
+*/
+static megaTGARowDecoder_t R_GetTGARowDecoderForLevel(int level, int pixelSize, int scale) {
+	// the wide stores only know how to repeat a pixel 2 or 4 times
+	if (scale != 1 && scale != 2 && scale != 4) {
+		level = TGA_DECODE_GENERIC;
+	}
+
+	switch (pixelSize) {
+	case 8:
+#ifdef MEGA_TGA_X86
+		if (level == TGA_DECODE_AVX2) {
+			return R_DecodeTGARowGray_AVX2;
+		}
+		if (level == TGA_DECODE_SSSE3) {
+			return R_DecodeTGARowGray_SSSE3;
+		}
+#endif
+		return R_DecodeTGARowGray_Generic;
+	case 24:
+#ifdef MEGA_TGA_X86
+		if (level == TGA_DECODE_AVX2) {
+			return R_DecodeTGARowBGR_AVX2;
+		}
+		if (level == TGA_DECODE_SSSE3) {
+			return R_DecodeTGARowBGR_SSSE3;
+		}
+#endif
+		return R_DecodeTGARowBGR_Generic;
+	case 32:
+#ifdef MEGA_TGA_X86
+		if (level == TGA_DECODE_AVX2) {
+			return R_DecodeTGARowBGRA_AVX2;
+		}
+		if (level == TGA_DECODE_SSSE3) {
+			return R_DecodeTGARowBGRA_SSSE3;
+		}
+#endif
+		return R_DecodeTGARowBGRA_Generic;
+	}
+	return nullptr;
+}
+
+/*
+===========================
+R_GetTGARowDecoder
+===========================
+*/
+megaTGARowDecoder_t R_GetTGARowDecoder(int pixelSize, int scale) {
+	return R_GetTGARowDecoderForLevel(R_GetTGADecodeLevel(), pixelSize, scale);
+}
+
+/*
+===========================
+rvmMegaTGABandReader::rvmMegaTGABandReader
+===========================
+*/
+rvmMegaTGABandReader::rvmMegaTGABandReader() {
+	bandSize = 0;
+	pixelSize = 0;
+	sourceBytes = 0;
+	bandBytes = 0;
+	band = nullptr;
+	block = nullptr;
+	blockLength = 0;
+	blockPos = 0;
+	packetPixels = 0;
+	packetIsRun = false;
+	memset(runPixel, 0, sizeof(runPixel));
+}
+
+/*
+===========================
+rvmMegaTGABandReader::~rvmMegaTGABandReader
+===========================
+*/
+rvmMegaTGABandReader::~rvmMegaTGABandReader() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaTGABandReader::Start
+
+A compressed file is read in blocks the size of an uncompressed band, so it takes the same
+memory either way and the disk sees a fraction of the reads. There is no telling how many
+blocks that is up front, so they are read until the file ends.
+===========================
+*/
+void rvmMegaTGABandReader::Start(idFile *file, const TargaHeader &targa_header, int bandRows, int numBands, int numBuffers, const char *name) {
+	Shutdown();
+
+	fileName = file->GetName();
+	pixelSize = targa_header.pixel_size >> 3;
+	bandSize = targa_header.width * pixelSize * bandRows;
+	sourceBytes = 0;
+	bandBytes = 0;
+
+	if (targa_header.image_type != 10) {
+		reader.Start(file, bandSize, numBands, numBuffers, name);
+		return;
+	}
+
+	band = (byte *)R_StaticAlloc(bandSize);
+	block = nullptr;
+	blockLength = 0;
+	blockPos = 0;
+	packetPixels = 0;
+	packetIsRun = false;
+
+	reader.Start(file, bandSize, -1, numBuffers, name);
+}
+
+/*
+===========================
+rvmMegaTGABandReader::Shutdown
+===========================
+*/
+void rvmMegaTGABandReader::Shutdown(void) {
+	reader.Shutdown();
+
+	if (band != nullptr) {
+		R_StaticFree(band);
+		band = nullptr;
+	}
+	block = nullptr;
+}
+
+/*
+===========================
+rvmMegaTGABandReader::NextBand
+===========================
+*/
+const byte *rvmMegaTGABandReader::NextBand(void) {
+	bandBytes += bandSize;
+
+	if (band == nullptr) {
+		sourceBytes += bandSize;
+		return reader.NextBlock();
+	}
+
+	DecodeBand();
+	return band;
+}
+
+/*
+===========================
+rvmMegaTGABandReader::ReleaseBand
+===========================
+*/
+void rvmMegaTGABandReader::ReleaseBand(void) {
+	// the compressed blocks go back as soon as they are used up
+	if (band == nullptr) {
+		reader.ReleaseBlock();
+	}
+}
+
+/*
+===========================
+rvmMegaTGABandReader::ReadPacketBytes
+
+Pulls bytes off the compressed stream, moving on to the next block whenever one runs out. The
+packets have to cover the whole image, so running out of file first is an error.
+===========================
+*/
+void rvmMegaTGABandReader::ReadPacketBytes(byte *out, int length) {
+	sourceBytes += length;
+
+	while (length > 0) {
+		if (block == nullptr) {
+			block = reader.NextBlock(&blockLength);
+			if (block == nullptr) {
+				common->Error("rvmMegaTGABandReader: %s ends before the image does", fileName.c_str());
+			}
+			blockPos = 0;
+		}
+
+		int count = Min(length, blockLength - blockPos);
+		memcpy(out, block + blockPos, count);
+		out += count;
+		length -= count;
+		blockPos += count;
+
+		if (blockPos == blockLength) {
+			reader.ReleaseBlock();
+			block = nullptr;
+		}
+	}
+}
+
+/*
+===========================
+rvmMegaTGABandReader::DecodeBand
+
+Expands packets into the band until it is full. Whatever is left of the last packet is picked
+up by the next band.
+===========================
+*/
+void rvmMegaTGABandReader::DecodeBand(void) {
+	byte *	out = band;
+	int		pixelsLeft = bandSize / pixelSize;
+
+	while (pixelsLeft > 0) {
+		if (packetPixels == 0) {
+			byte packetHeader;
+
+			ReadPacketBytes(&packetHeader, 1);
+			packetPixels = (packetHeader & 0x7f) + 1;
+			packetIsRun = (packetHeader & 0x80) != 0;
+			if (packetIsRun) {
+				ReadPacketBytes(runPixel, pixelSize);
+			}
+		}
+
+		int count = Min(packetPixels, pixelsLeft);
+
+		if (!packetIsRun) {
+			ReadPacketBytes(out, count * pixelSize);
+		}
+		else if (pixelSize == 4) {
+			uint32 pixel;
+
+			memcpy(&pixel, runPixel, 4);
+			for (int i = 0; i < count; i++) {
+				memcpy(out + i * 4, &pixel, 4);
+			}
+		}
+		else {
+			for (int i = 0; i < count; i++) {
+				out[i * 3 + 0] = runPixel[0];
+				out[i * 3 + 1] = runPixel[1];
+				out[i * 3 + 2] = runPixel[2];
+			}
+		}
+
+		out += count * pixelSize;
+		pixelsLeft -= count;
+		packetPixels -= count;
+	}
+}
+
+/*
+===========================
+megaTGABench
+
+Runs every row decoder this cpu has over the same random rows, checks them against the generic
+one and prints how fast they go.
+===========================
+*/
+CONSOLE_COMMAND(megaTGABench, "times the megatexture TGA row decoders, megaTGABench [megabytes]", 0) {
+	static const int BENCH_COLUMNS = 16384 + 7;		// odd so the tails get used
+	static const int pixelSizes[] = { 8, 24, 32 };
+	static const int scales[] = { 1, 2, 4 };
+
+	int megabytes = (args.Argc() > 1) ? Max(atoi(args.Argv(1)), 1) : 256;
+	int maxLevel = R_GetTGADecodeLevel();
+
+	byte *	in = (byte *)R_StaticAlloc(BENCH_COLUMNS * 4);
+	byte *	reference = (byte *)R_StaticAlloc(BENCH_COLUMNS * 4 * 4);
+	byte *	out = (byte *)R_StaticAlloc(BENCH_COLUMNS * 4 * 4);
+
+	idRandom random(0);
+	for (int i = 0; i < BENCH_COLUMNS * 4; i++) {
+		in[i] = (byte)random.RandomInt(256);
+	}
+
+	common->Printf("megaTGABench: %d MB of source per run, best decoder is %s\n", megabytes, tgaDecodeLevelNames[maxLevel]);
+	common->Printf("  bpp scale  decoder      in GB/s   out GB/s\n");
+
+	for (int p = 0; p < (int)(sizeof(pixelSizes) / sizeof(pixelSizes[0])); p++) {
+		for (int s = 0; s < (int)(sizeof(scales) / sizeof(scales[0])); s++) {
+			int		pixelSize = pixelSizes[p];
+			int		scale = scales[s];
+			int		rowBytes = BENCH_COLUMNS * (pixelSize >> 3);
+			int		outBytes = BENCH_COLUMNS * scale * 4;
+			int		numRows = Max((int)((int64_t)megabytes * 1024 * 1024 / rowBytes), 1);
+
+			R_GetTGARowDecoderForLevel(TGA_DECODE_GENERIC, pixelSize, scale)(in, reference, BENCH_COLUMNS, scale);
+
+			for (int level = TGA_DECODE_GENERIC; level <= maxLevel; level++) {
+				megaTGARowDecoder_t decodeRow = R_GetTGARowDecoderForLevel(level, pixelSize, scale);
+
+				memset(out, 0, outBytes);
+				decodeRow(in, out, BENCH_COLUMNS, scale);
+				if (memcmp(out, reference, outBytes) != 0) {
+					common->Warning("megaTGABench: %s decoder doesn't match generic for %d bpp scale %d", tgaDecodeLevelNames[level], pixelSize, scale);
+				}
+
+				uint64 startTime = Sys_Microseconds();
+				for (int row = 0; row < numRows; row++) {
+					decodeRow(in, out, BENCH_COLUMNS, scale);
+				}
+				float seconds = Max((Sys_Microseconds() - startTime) / 1000000.0f, 0.000001f);
+
+				common->Printf("  %3d %5d  %-10s %9.2f  %9.2f\n", pixelSize, scale, tgaDecodeLevelNames[level],
+					(float)rowBytes * numRows / seconds / (1024.0f * 1024.0f * 1024.0f), (float)outBytes * numRows / seconds / (1024.0f * 1024.0f * 1024.0f));
+			}
+		}
+	}
+
+	R_StaticFree(in);
+	R_StaticFree(reference);
+	R_StaticFree(out);
+}
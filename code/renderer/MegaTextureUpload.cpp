@@ -0,0 +1,265 @@
+/*
+===========================================================================
+
+IcedTech GPL Source Code
+
+Copyright (C) 2019 Real Vector Math Studios(Justin Marshall).
+Copyright (C) 1993-2012 id Software LLC, a ZeniMax Media company. 
+
+This file is part of the IcedTech GPL Source Code ("IcedTech GPL Source Code").  
+
+IcedTech GPL Source Code is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IcedTech GPL Source Code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IcedTech GPL Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, the IcedTech GPL Source Code is also subject to certain additional terms. You should have received a copy of these additional terms immediately following the terms and conditions of the GNU General Public License which accompanied the IcedTech GPL Source Code.  If not, please request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc., Suite 120, Rockville, Maryland 20850 USA.
+
+===========================================================================
+*/
+
+
+#include "precompiled.h"
+#pragma hdrstop
+
+#include "tr_local.h"
+
+idCVar idMegaTexture::r_megaTextureStagingBuffers("r_megaTextureStagingBuffers", "64", CVAR_RENDERER | CVAR_INTEGER, "tile buffers kept around for each megatexture to stream into, more than that come off the heap");
+
+static rvmMegaTextureGLUploadBackend glUploadBackend;
+
+rvmMegaTextureUploadBackend *rvmMegaTextureFile::uploadBackend = &glUploadBackend;
+
+/*
+===========================
+rvmMegaTileStagingPool::rvmMegaTileStagingPool
+===========================
+*/
+rvmMegaTileStagingPool::rvmMegaTileStagingPool() {
+	tileBytes = 0;
+	numBuffers = 0;
+	memory = nullptr;
+	numOverflows = 0;
+}
+
+/*
+===========================
+rvmMegaTileStagingPool::~rvmMegaTileStagingPool
+===========================
+*/
+rvmMegaTileStagingPool::~rvmMegaTileStagingPool() {
+	Shutdown();
+}
+
+/*
+===========================
+rvmMegaTileStagingPool::Init
+===========================
+*/
+void rvmMegaTileStagingPool::Init(int tileBytes, int numBuffers) {
+	Shutdown();
+
+	idScopedCriticalSection lock(poolLock);
+
+	this->tileBytes = tileBytes;
+	this->numBuffers = Max(numBuffers, 0);
+	numOverflows = 0;
+
+	if (this->numBuffers == 0) {
+		return;
+	}
+
+	// one block, the buffers never move for the life of the file
+	memory = (byte *)Mem_Alloc(this->numBuffers * tileBytes);
+
+	freeBuffers.SetNum(this->numBuffers);
+	for (int i = 0; i < this->numBuffers; i++) {
+		freeBuffers[i] = memory + i * tileBytes;
+	}
+}
+
+/*
+===========================
+rvmMegaTileStagingPool::Shutdown
+
+Everything handed out has to be back by now.
+===========================
+*/
+void rvmMegaTileStagingPool::Shutdown(void) {
+	idScopedCriticalSection lock(poolLock);
+
+	if (memory != nullptr) {
+		Mem_Free(memory);
+		memory = nullptr;
+	}
+	freeBuffers.Clear();
+	numBuffers = 0;
+}
+
+/*
+===========================
+rvmMegaTileStagingPool::IsPoolBuffer
+===========================
+*/
+bool rvmMegaTileStagingPool::IsPoolBuffer(const byte *buffer) const {
+	return memory != nullptr && buffer >= memory && buffer < memory + numBuffers * tileBytes;
+}
+
+/*
+===========================
+rvmMegaTileStagingPool::Alloc
+===========================
+*/
+byte *rvmMegaTileStagingPool::Alloc(void) {
+	{
+		idScopedCriticalSection lock(poolLock);
+
+		if (freeBuffers.Num() > 0) {
+			byte *buffer = freeBuffers[freeBuffers.Num() - 1];
+			freeBuffers.SetNum(freeBuffers.Num() - 1);
+			return buffer;
+		}
+		numOverflows++;
+	}
+
+	return (byte *)Mem_Alloc(tileBytes);
+}
+
+/*
+===========================
+rvmMegaTileStagingPool::Free
+===========================
+*/
+void rvmMegaTileStagingPool::Free(byte *buffer) {
+	{
+		idScopedCriticalSection lock(poolLock);
+
+		if (IsPoolBuffer(buffer)) {
+			freeBuffers.Append(buffer);
+			return;
+		}
+	}
+
+	Mem_Free(buffer);
+}
+
+/*
+===========================
+rvmMegaTextureUploadBackend::rvmMegaTextureUploadBackend
+===========================
+*/
+rvmMegaTextureUploadBackend::rvmMegaTextureUploadBackend() {
+	boundLevel = nullptr;
+	ClearCounters();
+}
+
+/*
+===========================
+rvmMegaTextureUploadBackend::ClearCounters
+===========================
+*/
+void rvmMegaTextureUploadBackend::ClearCounters(void) {
+	numBatches = 0;
+	numBinds = 0;
+	numUploads = 0;
+	numUploadedBytes = 0;
+}
+
+/*
+===========================
+rvmMegaTextureUploadBackend::BeginBatch
+
+Anything could have been bound since the last batch, so the first upload always binds.
+===========================
+*/
+void rvmMegaTextureUploadBackend::BeginBatch(void) {
+	boundLevel = nullptr;
+	numBatches++;
+}
+
+/*
+===========================
+rvmMegaTextureUploadBackend::EndBatch
+===========================
+*/
+void rvmMegaTextureUploadBackend::EndBatch(void) {
+	boundLevel = nullptr;
+}
+
+/*
+===========================
+rvmMegaTextureUploadBackend::UploadTile
+===========================
+*/
+void rvmMegaTextureUploadBackend::UploadTile(idTextureLevel *level, int x, int y, const byte *data) {
+	if (level != boundLevel) {
+		BindLevelImage(level);
+		boundLevel = level;
+		numBinds++;
+	}
+
+	UploadTileImage(level, x, y, data);
+	numUploads++;
+	numUploadedBytes += level->tileSize * level->tileSize;
+}
+
+/*
+===========================
+rvmMegaTextureGLUploadBackend::BindLevelImage
+===========================
+*/
+void rvmMegaTextureGLUploadBackend::BindLevelImage(idTextureLevel *level) {
+	if (level->image == nullptr) {
+		level->CreateImage();
+	}
+
+	level->image->Bind();
+}
+
+/*
+===========================
+rvmMegaTextureGLUploadBackend::UploadTileImage
+===========================
+*/
+void rvmMegaTextureGLUploadBackend::UploadTileImage(idTextureLevel *level, int x, int y, const byte *data) {
+	int size = level->tileSize;
+
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x * size, y * size, size, size, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, size * size, data);
+}
+
+/*
+===========================
+rvmMegaTextureNullUploadBackend::UploadTileImage
+===========================
+*/
+void rvmMegaTextureNullUploadBackend::UploadTileImage(idTextureLevel *level, int x, int y, const byte *data) {
+	if (!recordUploads) {
+		return;
+	}
+
+	megaTileUploadRecord_t record;
+	record.level = level;
+	record.x = x;
+	record.y = y;
+	record.bindNum = numBinds;
+	uploads.Append(record);
+}
+
+/*
+===========================
+rvmMegaTextureFile::SetUploadBackend
+===========================
+*/
+void rvmMegaTextureFile::SetUploadBackend(rvmMegaTextureUploadBackend *backend) {
+	uploadBackend = (backend != nullptr) ? backend : &glUploadBackend;
+}
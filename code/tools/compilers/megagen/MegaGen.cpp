@@ -31,6 +31,8 @@ If you have questions concerning this license or the applicable additional terms
 #include "precompiled.h"
 #pragma hdrstop
 
+#include "../../../renderer/tr_local.h"
+
 #include "MegaGen.h"
 
 /*
@@ -115,6 +117,22 @@ void EvaluateMegaLayer(int megaSize, int megaScanLine, MegaLayer *megaLayer, byt
 	}
 }
 
+/*
+===================
+EvaluateMegaScanLine
+
+Blends every layer of the project over megaScratch, the result is in targa byte order.
+===================
+*/
+void EvaluateMegaScanLine(int megaSize, int megaScanLine, rvmMegaProject &megaProject, byte *megaScratch) {
+	// Iterate over all the layers.
+	for (int layerId = 0; layerId < megaProject.GetNumMegaLayers(); layerId++)
+	{
+		// Evaluate the mega layer.
+		EvaluateMegaLayer(megaSize, megaScanLine, megaProject.GetMegaLayer(layerId), megaScratch);
+	}
+}
+
 /*
 ===================
 BuildMegaProject
@@ -132,20 +150,122 @@ void BuildMegaProject(int megaSize, idFile *megaTarga, rvmMegaProject &megaProje
 	{
 		//common->Printf("Writing scanline %d/%d\n", i, megaSize);
 
-		// Iterate over all the layers.
-		for (int layerId = 0; layerId < megaProject.GetNumMegaLayers(); layerId++)
-		{
-			// Evaluate the mega layer.
-			EvaluateMegaLayer(megaSize, i, megaProject.GetMegaLayer(layerId), scratchScanLine.Ptr());
-		}
+		EvaluateMegaScanLine(megaSize, i, megaProject, scratchScanLine.Ptr());
 
 		megaTarga->Write(scratchScanLine.Ptr(), megaSize * 4);
 	}
 }
 
+//
+// rvmMegaProjectBakeSource
+//
+// Hands the scanlines of a mega project to the megatexture bake as they are built, so the
+// giant TGA never has to go through the disk. They are still written out if there is a TGA.
+//
+class rvmMegaProjectBakeSource : public rvmMegaBakeSource {
+public:
+					rvmMegaProjectBakeSource(rvmMegaProject &megaProject, int megaSize, idFile *megaTarga);
+					~rvmMegaProjectBakeSource();
+
+	virtual int		GetWidth(void) const { return megaSize; }
+	virtual int		GetHeight(void) const { return megaSize; }
+
+	virtual void	Start(int bandRows, int numBands) { this->bandRows = bandRows; }
+	virtual void	ReadBand(byte *rgba);
+
+	virtual int64	GetBandBytes(void) const { return bandBytes; }
+
+	// Builds the scanlines the bake didn't need, so the TGA comes out whole.
+	void			Finish(void);
+private:
+	void			NextScanLine(void);
+
+	rvmMegaProject &				megaProject;
+	int								megaSize;
+	idFile *						megaTarga;
+	byte *							scanLine;			// blended over from one scanline to the next, like BuildMegaProject
+	int								scanLineNum;
+	int								bandRows;
+	int64							bandBytes;
+	megaTGARowDecoder_t				decodeRow;
+};
+
+/*
+===================
+rvmMegaProjectBakeSource::rvmMegaProjectBakeSource
+===================
+*/
+rvmMegaProjectBakeSource::rvmMegaProjectBakeSource(rvmMegaProject &megaProject, int megaSize, idFile *megaTarga) : megaProject(megaProject) {
+	this->megaSize = megaSize;
+	this->megaTarga = megaTarga;
+	scanLine = (byte *)Mem_ClearedAlloc(megaSize * 4);
+	scanLineNum = 0;
+	bandRows = 0;
+	bandBytes = 0;
+
+	// the scanlines are BGRA, same as they'd be in the TGA
+	decodeRow = R_GetTGARowDecoder(32, 1);
+
+	if (megaTarga != nullptr) {
+		WriteTargaHeader(megaTarga, megaSize, megaSize);
+	}
+}
+
+/*
+===================
+rvmMegaProjectBakeSource::~rvmMegaProjectBakeSource
+===================
+*/
+rvmMegaProjectBakeSource::~rvmMegaProjectBakeSource() {
+	Mem_Free(scanLine);
+}
+
+/*
+===================
+rvmMegaProjectBakeSource::NextScanLine
+===================
+*/
+void rvmMegaProjectBakeSource::NextScanLine(void) {
+	EvaluateMegaScanLine(megaSize, scanLineNum, megaProject, scanLine);
+	scanLineNum++;
+
+	if (megaTarga != nullptr) {
+		megaTarga->Write(scanLine, megaSize * 4);
+	}
+}
+
+/*
+===================
+rvmMegaProjectBakeSource::ReadBand
+===================
+*/
+void rvmMegaProjectBakeSource::ReadBand(byte *rgba) {
+	for (int row = 0; row < bandRows; row++) {
+		NextScanLine();
+		decodeRow(scanLine, rgba + row * megaSize * 4, megaSize, 1);
+	}
+	bandBytes += bandRows * megaSize * 4;
+}
+
+/*
+===================
+rvmMegaProjectBakeSource::Finish
+===================
+*/
+void rvmMegaProjectBakeSource::Finish(void) {
+	while (megaTarga != nullptr && scanLineNum < megaSize) {
+		NextScanLine();
+	}
+}
+
 /*
 ===================
 RunMegaGen_f
+
+megagen <mega_project> <mega_size> [-bake] [-tileSize <size>] [-tga]
+
+With -bake the scanlines go straight into the megatexture bake instead of megagen/bin, the TGA
+is only written as well with -tga.
 ===================
 */
 void RunMegaGen_f(const idCmdArgs &args) {
@@ -154,15 +274,50 @@ void RunMegaGen_f(const idCmdArgs &args) {
 	common->SetRefreshOnPrint(true);
 
 	if (args.Argc() < 3) {
-		common->Warning("Usage: megagen <mega_project> <mega_size>\n");
+		common->Warning("Usage: megagen <mega_project> <mega_size> [-bake] [-tileSize <size>] [-tga]\n");
+		common->SetRefreshOnPrint(false);
+		return;
+	}
+
+	bool	bake = false;
+	bool	writeTarga = false;
+	int		tileSize = DEFAULT_TILE_SIZE;
+	bool	tileSizeGiven = false;
+
+	for (int i = 3; i < args.Argc(); i++) {
+		if (!idStr::Icmp(args.Argv(i), "-bake")) {
+			bake = true;
+		}
+		else if (!idStr::Icmp(args.Argv(i), "-tga")) {
+			writeTarga = true;
+		}
+		else if (!idStr::Icmp(args.Argv(i), "-tileSize") && i + 1 < args.Argc()) {
+			tileSize = atoi(args.Argv(++i));
+			tileSizeGiven = true;
+		}
+		else {
+			common->Warning("megagen: unknown option %s\n", args.Argv(i));
+		}
+	}
+
+	if (bake && (!idMath::IsPowerOfTwo(tileSize) || tileSize < MIN_TILE_SIZE || tileSize > MAX_TILE_SIZE)) {
+		common->Warning("megagen: tileSize must be a power of two between %d and %d\n", MIN_TILE_SIZE, MAX_TILE_SIZE);
 		common->SetRefreshOnPrint(false);
 		return;
 	}
 
+	// without the bake the TGA is the whole point
+	if (!bake) {
+		if (tileSizeGiven) {
+			common->Warning("megagen: -tileSize only applies with -bake, ignoring it\n");
+		}
+		writeTarga = true;
+	}
+
 	idStr megaProjectName = va("megagen/%s.megagen", args.Argv(1));
 	idStr megaTargaName = va("megagen/bin/%s.tga", args.Argv(1));
 
-	idFileScoped megaTarga(fileSystem->OpenFileWrite(megaTargaName));
+	idFileScoped megaTarga(writeTarga ? fileSystem->OpenFileWrite(megaTargaName) : nullptr);
 
 	int megaSize = atoi(args.Argv(2));
 
@@ -186,10 +341,30 @@ void RunMegaGen_f(const idCmdArgs &args) {
 		return;
 	}
 
-	// Build it!!!!
-	BuildMegaProject(megaSize, megaTarga, megaProject);
+	if (!bake) {
+		// Build it!!!!
+		BuildMegaProject(megaSize, megaTarga, megaProject);
+
+		common->Printf("MegaProject built successfully!");
+
+		common->SetRefreshOnPrint(false);
+		return;
+	}
+
+	// Build it straight into the megatexture.
+	rvmMegaProjectBakeSource bakeSource(megaProject, megaSize, megaTarga);
 
-	common->Printf("MegaProject built successfully!");
+	bool baked = idMegaTexture::BakeMegaTexture(args.Argv(1), &bakeSource, tileSize);
+
+	// the bake can give up before it read anything, the TGA still has to come out whole
+	bakeSource.Finish();
+
+	if (baked) {
+		common->Printf("MegaProject built and baked successfully!");
+	}
+	else if (writeTarga) {
+		common->Warning("megagen: failed to bake %s, only %s was written\n", args.Argv(1), megaTargaName.c_str());
+	}
 
 	common->SetRefreshOnPrint(false);
 }
\ No newline at end of file